@@ -2,7 +2,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <set>
 
 using namespace std;
 
@@ -10,13 +15,49 @@ class Pager;
 class Table;
 
 
+const uint32_t BTREE_NODE_SIZE = 4096;
+
 enum NodeType : uint8_t { INTERNAL, LEAF };
 
 struct NodeHeader{
     NodeType type;
     uint8_t isRoot;
     uint16_t numCells;
-    int32_t parent;
+    uint32_t nextFree; // in the root: head of the free-page list (0 = empty), in a free page: the next one
+};
+
+// Nodes do not point to their parents. A descent records the internal nodes it
+// passes instead, root first, with the child slot it took in each (numCells for
+// the right child); splits and merges walk back up this path.
+struct PathEntry{
+    uint32_t pageNum;
+    uint16_t childIdx;
+};
+
+const uint32_t BTREE_MAX_DEPTH = 32; // far above any real tree, even 256-byte keys fan out 8 ways
+
+struct BtreePath{
+    PathEntry nodes[BTREE_MAX_DEPTH];
+    uint32_t depth = 0;
+};
+
+// Every node carries a version that doubles as its latch. A writer latches a node by
+// setting the low bit and releases it with a new version. Readers take no latch: they
+// read the version, then the node, then check the version again, and start over if it
+// moved. A reader never blocks a writer, and only waits while a node is being written.
+const uint32_t NODE_LOCKED = 1;
+
+const uint32_t WRITE_SET_PAGES = 4 * BTREE_MAX_DEPTH; // a path, a sibling or new page per level, and a new root
+
+// Nodes a writer holds latched and pinned, released together when it is done.
+// Pages it freed go back on the free list only then, once nobody holds their latch.
+struct WriteSet{
+    uint32_t pageNums[WRITE_SET_PAGES];
+    void* nodes[WRITE_SET_PAGES];
+    uint32_t count = 0;
+
+    uint32_t freed[BTREE_MAX_DEPTH + 1];
+    uint32_t freedCount = 0;
 };
 
 template<typename T>
@@ -25,25 +66,40 @@ struct LeafCell{
     uint32_t rowId;
 };
 
+// (key, rowId) order, the order cells are kept in. LeafCell is only used to
+// move pairs around (bulk load), nodes keep keys and rowIds in separate arrays.
 template<typename T>
-struct InternalCell{
-    T key;
-    uint32_t rowId;
-    uint32_t childPage;
+struct CellLess{
+    bool operator()(const LeafCell<T>& a, const LeafCell<T>& b) const {
+        return a.key < b.key || (a.key == b.key && a.rowId < b.rowId);
+    }
 };
 
+// Nodes are laid out as arrays, not as arrays of cells: the keys are contiguous
+// (and 16-byte aligned) so a search compares several of them per SIMD instruction,
+// and rowIds and child pointers are only read once the slot is known.
+// Cell i is (keys[i], rowIds[i]), plus childPages[i] in internal nodes.
 template<typename T>
 struct LeafNode{
+    inline static constexpr uint32_t MAX_CELLS = (BTREE_NODE_SIZE - 16) / (sizeof(T) + sizeof(uint32_t));
+
     NodeHeader header;
     uint32_t nextLeaf;
-    LeafCell<T> cells[0];
+    uint32_t version; // latch, see NODE_LOCKED
+    T keys[MAX_CELLS];
+    uint32_t rowIds[MAX_CELLS];
 };
 
 template<typename T>
 struct InternalNode{
+    inline static constexpr uint32_t MAX_CELLS = (BTREE_NODE_SIZE - 16) / (sizeof(T) + 2 * sizeof(uint32_t));
+
     NodeHeader header;
     uint32_t rightChild;
-    InternalCell<T> cells[0];
+    uint32_t version;
+    T keys[MAX_CELLS];
+    uint32_t rowIds[MAX_CELLS];
+    uint32_t childPages[MAX_CELLS]; // child i holds cells below (keys[i], rowIds[i])
 };
 
 template<typename T>
@@ -53,6 +109,16 @@ struct InsertResult{
     T splitKey;
     uint32_t splitRowId;
     uint32_t rightChildPageNum;
+    bool append; // the split node was the last of its level and the cell went past its end
+};
+
+// Yields the rowIds of a range in (key, rowId) order, up to max per call, without
+// collecting the range first. Between calls it holds no pin and no latch: it remembers
+// the leaf and slot it stopped at, and descends again if a writer changed that leaf.
+class BtreeCursor{
+public:
+    virtual ~BtreeCursor() = default;
+    virtual uint32_t Next(uint32_t* outRowIds, uint32_t max) = 0; // 0 once the range is done
 };
 
 //generic interface for Btree<T>
@@ -61,13 +127,21 @@ public:
     virtual ~BtreeIndex() = default;
 
     virtual void CreateIndex() = 0;
+    virtual void BulkLoad(uint32_t columnOffset) = 0; // builds an empty index from the table's live rows
 
     virtual void Insert(void* key, uint32_t rowId) = 0;
+    virtual void InsertBatch(const void* keys, const uint32_t* rowIds, uint32_t n) = 0; // keys: n column values back to back
+    virtual bool Delete(void* key, uint32_t rowId) = 0; // false if the entry is not in the index
     virtual void SelectRange(void* L, void* R, vector<uint32_t>& outRowIds) = 0;
+    virtual uint32_t CountRange(void* L, void* R) = 0; // reads leaves only
     virtual uint32_t DeleteRange(void* L, void* R) = 0;
+    virtual BtreeCursor* OpenRange(void* L, void* R) = 0; // the caller deletes it, before the index
+    virtual void Flush() = 0; // applies buffered writes to the tree, see writeBufferCells
 
-    virtual void FlushAll() = 0;
-
+public:
+    // Writes an index holds back before applying them together, 0 to apply each one at once.
+    // Set from --index-buffer=<cells>, read when an index is opened.
+    inline static uint32_t writeBufferCells = 0;
 };
 
 
@@ -75,61 +149,173 @@ template<typename T>
 class Btree : public BtreeIndex{
 
 public:
-    Btree(Pager* p, Table* t);
+    Btree(Pager* p, Table* t, uint32_t keySize = sizeof(T)); // keySize: width of the column, at most sizeof(T)
     ~Btree();
 
     void CreateIndex() override;
+    void BulkLoad(uint32_t columnOffset) override;
 
     void Insert(void* key, uint32_t rowId) override;
+    void InsertBatch(const void* keys, const uint32_t* rowIds, uint32_t n) override;
+    bool Delete(void* key, uint32_t rowId) override;
     void SelectRange(void* L, void* R, vector<uint32_t>& outRowIds) override;
+    uint32_t CountRange(void* L, void* R) override;
     uint32_t DeleteRange(void* L, void* R) override;
+    BtreeCursor* OpenRange(void* L, void* R) override;
+    void Flush() override;
 
-    void FlushAll() override;
-
-    
+    // Walks the whole tree and returns what is wrong with it, empty if nothing is.
+    // Only meaningful while no other thread writes to the tree.
+    string Check();
 
 private:
+    class Cursor : public BtreeCursor{
+    public:
+        Cursor(Btree<T>* tree, T L, T R);
+        uint32_t Next(uint32_t* outRowIds, uint32_t max) override;
+        uint32_t NextCells(uint32_t* outRowIds, T* outKeys, uint32_t max); // with their keys, unless outKeys is null
+        void Seek(T key, uint32_t rowId); // go on after (key, rowId)
+
+    private:
+        Btree<T>* tree;
+        T L, R;
+        T lastKey; // last cell handed out, the walk resumes after it
+        uint32_t lastRowId;
+        bool resumed;
+        bool done;
+
+        bool positioned; // leafPageNum at version, slot is the next cell to hand out
+        uint32_t leafPageNum;
+        uint32_t version;
+        uint16_t slot;
+
+        BtreePath path; // of the last descent, for PrefetchSiblings
+        uint32_t lastPrefetched;
+    };
+
+    // The tree's cells merged with the write buffer: pending inserts come in order,
+    // cells pending deletion are left out.
+    class MergeCursor : public BtreeCursor{
+    public:
+        MergeCursor(Btree<T>* tree, T L, T R);
+        uint32_t Next(uint32_t* outRowIds, uint32_t max) override;
+
+    private:
+        Btree<T>* tree;
+        T L, R;
+        Cursor cursor;
+        uint64_t flushes; // the tree's when the cursor last read it
+
+        // cells read from the tree but not handed out yet
+        T keys[LeafNode<T>::MAX_CELLS];
+        uint32_t rowIds[LeafNode<T>::MAX_CELLS];
+        uint32_t pos;
+        uint32_t count;
+        bool treeDone;
+
+        LeafCell<T> last; // last cell handed out
+        bool started;
+    };
+
     void InsertLogic(T key, uint32_t rowId);
+    bool AppendToLastLeaf(T key, uint32_t rowId);
+    void InsertLocked(T key, uint32_t rowId);
+    void InsertBatchLogic(LeafCell<T>* cells, uint32_t n);
+    void BufferInsert(T key, uint32_t rowId);
+    bool BufferDelete(T key, uint32_t rowId);
+    bool Contains(T key, uint32_t rowId); // the tree, not the buffer, holds the cell
+    bool Buffered(T L, T R); // a pending write falls in [L, R]
+    static void LeafNodeMerge(LeafNode<T>* node, const LeafCell<T>* cells, uint16_t count); // sorted cells, node has room
+    bool DeleteLogic(T key, uint32_t rowId);
+    bool DeleteLocked(T key, uint32_t rowId);
     void SelectRangeLogic(T L, T R, vector<uint32_t>& outRowIds);
+    uint32_t CountRangeLogic(T L, T R);
     uint32_t DeleteRangeLogic(T L, T R);
 
-    void CreateNewRoot(NodeHeader* root, T splitKey, uint32_t splitRowId, uint32_t rightChildPageNum);
+    void CreateNewRoot(T splitKey, uint32_t splitRowId, uint32_t rightChildPageNum, WriteSet& ws);
     void InitializeLeafNode(LeafNode<T>* node);
+    static void CopyNode(void* dest, const void* src); // everything but the latch
 
-    uint32_t FindLeaf(uint32_t pageNum, T key, uint32_t rowId);
-    uint32_t InternalNodeFindChild(InternalNode<T>* node, T targetKey, uint32_t targetRowId);
+    LeafNode<T>* FindLeaf(T key, uint32_t rowId, BtreePath& path, uint32_t& leafPageNum, uint32_t& version, LeafCell<T>* high = nullptr, bool* bounded = nullptr);
+    uint32_t FindLeafLocked(T key, uint32_t rowId, BtreePath& path, WriteSet& ws, bool inserting);
     uint16_t LeafNodeFindSlot(LeafNode<T>* node, T targetKey, uint32_t targetRowId);
+    static uint16_t UpperBound(const T* keys, const uint32_t* rowIds, uint16_t n, T key, uint32_t rowId);
 
-    InsertResult<T> InternalNodeInsert(InternalNode<T>* node, T key, uint32_t rowId, uint32_t rightChildPage);
-    InsertResult<T> LeafNodeInsert(LeafNode<T>* node, T key, uint32_t rowId);
+    // move cells between or within nodes, every array shifts together; ranges may overlap
+    static void MoveCells(LeafNode<T>* dest, uint16_t destIdx, LeafNode<T>* src, uint16_t srcIdx, uint16_t count);
+    static void MoveCells(InternalNode<T>* dest, uint16_t destIdx, InternalNode<T>* src, uint16_t srcIdx, uint16_t count);
+
+    InsertResult<T> InternalNodeInsert(InternalNode<T>* node, T key, uint32_t rowId, uint32_t rightChildPage, bool append, WriteSet& ws);
+    InsertResult<T> LeafNodeInsert(LeafNode<T>* node, T key, uint32_t rowId, WriteSet& ws);
 
     bool LeafNodeInsertNonFull(LeafNode<T>* node, T key, uint32_t rowId);
-    
+    bool LeafNodeRemove(LeafNode<T>* node, T key, uint32_t rowId); // false if the cell is not there
+
+    void InsertIntoParent(BtreePath& path, T key, uint32_t rowId, uint32_t rightChildPageNum, bool append, WriteSet& ws);
 
-    void InsertIntoParent(NodeHeader* leftChild, T key, uint32_t rowId, uint32_t rightChildPageNum);
-    void UpdateChildParents(InternalNode<T>* parentNode, uint32_t parentPageNum);
+    void RebalanceLeaf(BtreePath& path, uint32_t pageNum, WriteSet& ws);
+    void RebalanceInternal(BtreePath& path, WriteSet& ws);
+    void RemoveSeparator(InternalNode<T>* parent, uint16_t idx);
+    void CollapseRoot(WriteSet& ws);
 
-    void LeafNodeSelectRange(LeafNode<T>* node, T L, T R, vector<uint32_t>& outRowIds);
-    uint16_t LeafNodeDeleteRange(LeafNode<T>* node, T L, T R);
-    
+    uint32_t ChildAt(InternalNode<T>* node, uint16_t idx);
+    void SetChildAt(InternalNode<T>* node, uint16_t idx, uint32_t childPageNum);
 
+    uint32_t AllocatePage(WriteSet& ws); // the new page is latched in ws
+    void FreePage(uint32_t pageNum);
+
+    // latches, see NODE_LOCKED
+    static atomic_ref<uint32_t> Version(void* node);
+    static uint32_t ReadVersion(void* node); // waits while a writer holds the node
+    static bool Validate(void* node, uint32_t version); // nothing was written since ReadVersion
+    static bool TryUpgrade(void* node, uint32_t version); // latches the node if it is still at version
+    static void WriteLock(void* node);
+    static void WriteUnlock(void* node, bool changed); // unchanged nodes keep their version
+    static bool IsSafe(void* node, bool inserting); // the operation cannot change anything above the node
+    void* LockPage(WriteSet& ws, uint32_t pageNum);
+    void ReleaseAbove(WriteSet& ws); // all but the last node latched, unchanged
+    void ReleaseAll(WriteSet& ws);
+
+    uint32_t PrefetchSiblings(BtreePath& path, LeafNode<T>* leaf, uint32_t leafPageNum, T R);
+    bool NextParent(BtreePath& path);
+
+    string CheckNode(uint32_t pageNum, uint32_t depth, const LeafCell<T>* low, const LeafCell<T>* high, vector<uint32_t>& leaves, vector<bool>& seen, uint32_t& leafDepth);
 
 
 public:
     Pager* pager;
     Table* table;
     uint32_t rootPageNum;
+    uint32_t keySize;
+    mutex allocMutex; // guards the free-page list and the growth of the file
+    atomic<uint32_t> lastLeaf; // hint: the leaf with no next leaf, where growing keys go
+
+    // Write buffer. Up to bufferLimit inserts and deletes wait here and are applied
+    // together, sorted, so each leaf is read and written once per flush instead of once
+    // per write. Reads merge it in. Deletes are blind: they do not look in the tree.
+    // Unlike the tree it is not thread-safe, a buffered index is used from one thread.
+    uint32_t bufferLimit;
+    set<LeafCell<T>, CellLess<T>> pendingInserts;
+    set<LeafCell<T>, CellLess<T>> pendingDeletes; // applied before the inserts
+    uint64_t flushes;
 
 
 public:
-    inline static const uint32_t LEAF_NODE_SIZE = 4096;
-    inline static const uint32_t INTERNAL_NODE_SIZE = 4096;
+    inline static const uint32_t LEAF_NODE_SIZE = BTREE_NODE_SIZE;
+    inline static const uint32_t INTERNAL_NODE_SIZE = BTREE_NODE_SIZE;
     inline static const uint32_t HEADER_SIZE = sizeof(NodeHeader);
-    inline static const uint32_t LEAF_CELL_SIZE = sizeof(LeafCell<T>);
-    inline static const uint32_t INTERNAL_CELL_SIZE = sizeof(InternalCell<T>);
 
-    inline static const uint32_t LEAF_NODE_MAX_CELLS = (LEAF_NODE_SIZE - sizeof(LeafNode<T>)) / LEAF_CELL_SIZE;
-    inline static const uint32_t INTERNAL_NODE_MAX_CELLS = (INTERNAL_NODE_SIZE - sizeof(InternalNode<T>)) / INTERNAL_CELL_SIZE;
+    inline static const uint32_t LEAF_NODE_MAX_CELLS = LeafNode<T>::MAX_CELLS;
+    inline static const uint32_t INTERNAL_NODE_MAX_CELLS = InternalNode<T>::MAX_CELLS;
+
+    static_assert(sizeof(LeafNode<T>) <= BTREE_NODE_SIZE && sizeof(InternalNode<T>) <= BTREE_NODE_SIZE);
+    static_assert(offsetof(LeafNode<T>, version) == offsetof(InternalNode<T>, version)); // either node is latched the same way
+
+    // below these a non-root node borrows from or merges with a sibling
+    inline static const uint32_t LEAF_NODE_MIN_CELLS = LEAF_NODE_MAX_CELLS / 2;
+    inline static const uint32_t INTERNAL_NODE_MIN_CELLS = INTERNAL_NODE_MAX_CELLS / 2;
+
+    inline static const uint32_t BULK_LOAD_FILL = 90; // percent of a node filled by BulkLoad, the rest absorbs later inserts
 };
 
 #include "Btree.tpp"
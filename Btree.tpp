@@ -3,13 +3,18 @@
 #include "Pager.h"  
 #include "Schema.h" 
 #include "Common.h"
+#include "ExternalSort.h"
+#include "KeySearch.h"
+#include "FixedKey.h"
 
 #include <cstring>
+#include <iostream>
+#include <thread>
 #include <algorithm> // for memmove
 
 template<typename T>
-Btree<T>::Btree(Pager* p, Table* t)
-    : pager(p), table(t), rootPageNum(0)
+Btree<T>::Btree(Pager* p, Table* t, uint32_t keySize)
+    : pager(p), table(t), rootPageNum(0), keySize(keySize), lastLeaf(0), bufferLimit(BtreeIndex::writeBufferCells), flushes(0)
 {
 
 }
@@ -26,106 +31,1046 @@ void Btree<T>::CreateIndex(){
     root->header.isRoot = 1;
 }
 
+// Builds the tree bottom-up instead of inserting row by row: one pass over the heap,
+// sort the (key, rowId) pairs (spilling sorted runs to disk past SORT_MEMORY_BYTES),
+// then write the leaves and every internal level in page order. Node counts per level
+// are known up front, so each level's page range is too and every node is written once.
+// Page 0 is reserved first and receives the root last.
+template<typename T>
+void Btree<T>::BulkLoad(uint32_t columnOffset){
+    ExternalSort<LeafCell<T>, CellLess<T>> sorter(pager->fileName);
+    {
+        ScanGuard scan(table->pager);
+        for(uint32_t rowId = 0; rowId < table->rowCount; rowId++){
+            char* slot = (char*)table->RowSlot(rowId, 0);
+            if(*(uint8_t*)slot == 1) continue; // deleted
+            sorter.Add({LoadKey<T>(slot + columnOffset, keySize), rowId});
+        }
+    }
+    sorter.Finish();
+
+    uint32_t count = sorter.Count();
+    uint32_t leafFill = max<uint32_t>(1, LEAF_NODE_MAX_CELLS * BULK_LOAD_FILL / 100);
+    uint32_t fanout = max<uint32_t>(2, INTERNAL_NODE_MAX_CELLS * BULK_LOAD_FILL / 100 + 1);
+
+    // nodes per level, leaves first, the last level is the root
+    vector<uint32_t> levelNodes = {max<uint32_t>(1, (count + leafFill - 1) / leafFill)};
+    while(levelNodes.back() > 1) levelNodes.push_back((levelNodes.back() + fanout - 1) / fanout);
+
+    vector<uint32_t> firstPage(levelNodes.size(), rootPageNum);
+    uint32_t nextPage = rootPageNum + 1;
+    for(size_t l = 0; l + 1 < levelNodes.size(); l++){
+        firstPage[l] = nextPage;
+        nextPage += levelNodes[l];
+    }
+
+    // n items spread over m nodes as evenly as possible, the first n % m get one more
+    auto share = [](uint32_t n, uint32_t m, uint32_t i){ return n / m + (i < n % m); };
+
+    struct Child{
+        T key; // smallest (key, rowId) under this node
+        uint32_t rowId;
+        uint32_t pageNum;
+    };
+    vector<Child> children;
+
+    pager->GetPage(rootPageNum, 1);
+    ScanGuard scan(pager); // every node is written once, don't let them push other pages out
+
+    bool isRoot = levelNodes.size() == 1;
+    for(uint32_t i = 0; i < levelNodes[0]; i++){
+        uint32_t pageNum = firstPage[0] + i;
+        LeafNode<T>* leaf = (LeafNode<T>*)pager->GetPage(pageNum, 1);
+        InitializeLeafNode(leaf);
+        leaf->header.isRoot = isRoot;
+        leaf->nextLeaf = i + 1 < levelNodes[0] ? pageNum + 1 : 0;
+
+        uint16_t cells = share(count, levelNodes[0], i);
+        LeafCell<T> cell{};
+        for(uint16_t c = 0; c < cells; c++){
+            if(!sorter.Next(cell)){
+                cerr << "Error: Index " << pager->fileName << " ran out of sorted rows while bulk loading" << endl;
+                exit(1);
+            }
+            leaf->keys[c] = cell.key;
+            leaf->rowIds[c] = cell.rowId;
+        }
+        leaf->header.numCells = cells;
+
+        if(cells > 0) children.push_back({leaf->keys[0], leaf->rowIds[0], pageNum});
+    }
+
+    for(size_t l = 1; l < levelNodes.size(); l++){
+        isRoot = l + 1 == levelNodes.size();
+
+        vector<Child> level;
+        uint32_t first = 0;
+        for(uint32_t i = 0; i < levelNodes[l]; i++){
+            uint32_t pageNum = firstPage[l] + i;
+            uint32_t n = share(children.size(), levelNodes[l], i);
+
+            InternalNode<T>* node = (InternalNode<T>*)pager->GetPage(pageNum, 1);
+            node->header.type = INTERNAL;
+            node->header.isRoot = isRoot;
+            node->header.numCells = n - 1;
+            node->header.nextFree = 0;
+
+            // child k holds keys below the first key of child k+1
+            for(uint32_t k = 0; k + 1 < n; k++){
+                Child& right = children[first + k + 1];
+                node->keys[k] = right.key;
+                node->rowIds[k] = right.rowId;
+                node->childPages[k] = children[first + k].pageNum;
+            }
+            node->rightChild = children[first + n - 1].pageNum;
+
+            level.push_back({children[first].key, children[first].rowId, pageNum});
+            first += n;
+        }
+        children.swap(level);
+    }
+}
+
 template<typename T>
 void Btree<T>::Insert(void* key, uint32_t rowId){
-    InsertLogic(*(T*) key, rowId);
+    if(bufferLimit) BufferInsert(LoadKey<T>(key, keySize), rowId);
+    else InsertLogic(LoadKey<T>(key, keySize), rowId);
+}
+
+template<typename T>
+void Btree<T>::InsertBatch(const void* keys, const uint32_t* rowIds, uint32_t n){
+    vector<LeafCell<T>> cells(n);
+    for(uint32_t i = 0; i < n; i++) cells[i] = {LoadKey<T>((const char*)keys + (size_t)i * keySize, keySize), rowIds[i]};
+    sort(cells.begin(), cells.end(), CellLess<T>());
+    Flush(); // a buffered delete may be of a cell the batch puts back
+    InsertBatchLogic(cells.data(), n);
+}
+
+template<typename T>
+uint32_t Btree<T>::CountRange(void* L, void* R){
+    return CountRangeLogic(LoadKey<T>(L, keySize), LoadKey<T>(R, keySize));
+}
+
+template<typename T>
+bool Btree<T>::Delete(void* key, uint32_t rowId){
+    if(bufferLimit) return BufferDelete(LoadKey<T>(key, keySize), rowId);
+    return DeleteLogic(LoadKey<T>(key, keySize), rowId);
 }
 
 template<typename T>
 void Btree<T>::SelectRange(void* L, void* R, vector<uint32_t>& outRowIds){
-    SelectRangeLogic(*(T*) L, *(T*) R, outRowIds);
+    SelectRangeLogic(LoadKey<T>(L, keySize), LoadKey<T>(R, keySize), outRowIds);
 }
 
 template<typename T>
-uint32_t Btree<T>::DeleteRange(void* L, void* R){
-    return DeleteRangeLogic(*(T*) L, *(T*) R);
+BtreeCursor* Btree<T>::OpenRange(void* L, void* R){
+    T l = LoadKey<T>(L, keySize), r = LoadKey<T>(R, keySize);
+    if(bufferLimit) return new MergeCursor(this, l, r); // writes between batches may land in the range
+    return new Cursor(this, l, r);
+}
+
+// Sorted, the pending writes reach each leaf in one visit: the deletes one by one,
+// in key order, then the inserts as one batch.
+template<typename T>
+void Btree<T>::Flush(){
+    if(pendingInserts.empty() && pendingDeletes.empty()) return;
+
+    for(const LeafCell<T>& cell : pendingDeletes) DeleteLogic(cell.key, cell.rowId);
+    vector<LeafCell<T>> cells(pendingInserts.begin(), pendingInserts.end());
+    InsertBatchLogic(cells.data(), cells.size());
+
+    pendingDeletes.clear();
+    pendingInserts.clear();
+    flushes++;
+}
+
+template<typename T>
+void Btree<T>::BufferInsert(T key, uint32_t rowId){
+    // a pending delete of the same cell stays: it goes first, in case the tree has the cell
+    pendingInserts.insert({key, rowId});
+    if(pendingInserts.size() + pendingDeletes.size() >= bufferLimit) Flush();
+}
+
+// False, like DeleteLogic, if the cell is neither pending insertion nor in the tree.
+// A cell already pending deletion counts as gone. Finding out costs a descent but no
+// write: the leaf is still changed only once, at the next flush.
+template<typename T>
+bool Btree<T>::BufferDelete(T key, uint32_t rowId){
+    if(pendingInserts.erase({key, rowId})) return 1;
+    if(pendingDeletes.count({key, rowId}) || !Contains(key, rowId)) return 0;
+
+    pendingDeletes.insert({key, rowId});
+    if(pendingInserts.size() + pendingDeletes.size() >= bufferLimit) Flush();
+    return 1;
+}
+
+// The cursor starts right after (key, rowId - 1), so its first cell of key is the one
+template<typename T>
+bool Btree<T>::Contains(T key, uint32_t rowId){
+    Cursor cursor(this, key, key);
+    if(rowId > 0) cursor.Seek(key, rowId - 1);
+    uint32_t found;
+    return cursor.Next(&found, 1) == 1 && found == rowId;
+}
+
+template<typename T>
+bool Btree<T>::Buffered(T L, T R){
+    auto ins = pendingInserts.lower_bound({L, 0});
+    auto del = pendingDeletes.lower_bound({L, 0});
+    return (ins != pendingInserts.end() && ins->key <= R) || (del != pendingDeletes.end() && del->key <= R);
 }
 
 template<typename T>
-void Btree<T>::FlushAll(){
-    pager->FlushAll();
+uint32_t Btree<T>::DeleteRange(void* L, void* R){
+    return DeleteRangeLogic(LoadKey<T>(L, keySize), LoadKey<T>(R, keySize));
 }
 
 
 
+// Optimistic first: descend without latches and latch only the leaf, which is all an
+// insert that does not split writes. A full leaf starts over with InsertLocked.
 template<typename T>
 void Btree<T>::InsertLogic(T key, uint32_t rowId){
-    uint32_t leafPageNum = FindLeaf(rootPageNum, key, rowId);
-    LeafNode<T>* leaf = (LeafNode<T>*) pager->GetPage(leafPageNum, 1);
+    if(AppendToLastLeaf(key, rowId)) return;
+
+    while(true){
+        BtreePath path;
+        uint32_t leafPageNum, version;
+        LeafNode<T>* leaf = FindLeaf(key, rowId, path, leafPageNum, version);
+        if(!leaf) continue;
+
+        if(leaf->header.numCells < LEAF_NODE_MAX_CELLS){
+            bool latched = TryUpgrade(leaf, version);
+            if(latched){
+                LeafNodeInsertNonFull(leaf, key, rowId);
+                if(leaf->nextLeaf == 0) lastLeaf.store(leafPageNum, memory_order_relaxed);
+                pager->MarkDirty(leafPageNum);
+                WriteUnlock(leaf, 1);
+            }
+            pager->UnpinPage(leafPageNum);
+            if(latched) return;
+            continue;
+        }
+
+        bool full = Validate(leaf, version);
+        pager->UnpinPage(leafPageNum);
+        if(full) break;
+    }
+
+    InsertLocked(key, rowId);
+}
+
+template<typename T>
+void Btree<T>::InsertLocked(T key, uint32_t rowId){
+    BtreePath path;
+    WriteSet ws;
+    uint32_t leafPageNum = FindLeafLocked(key, rowId, path, ws, 1);
+    LeafNode<T>* leaf = (LeafNode<T>*)LockPage(ws, leafPageNum);
+
+    InsertResult<T> res = LeafNodeInsert(leaf, key, rowId, ws);
+    if(res.didSplit) InsertIntoParent(path, res.splitKey, res.splitRowId, res.rightChildPageNum, res.append, ws);
+    ReleaseAll(ws);
+}
+
+// Sorted, a batch goes in a leaf at a time: one descent finds the leaf of the next cell
+// and the separator after it, and the cells that follow go into the same leaf, under
+// one latch, while they sort below that separator and the leaf has room. A full leaf
+// takes a single cell through InsertLocked, which splits it, and the rest fill the
+// halves. The parent is only written by those splits, and the descents run in key
+// order, so they mostly read pages the previous one just read.
+template<typename T>
+void Btree<T>::InsertBatchLogic(LeafCell<T>* cells, uint32_t n){
+    CellLess<T> less;
+    uint32_t i = 0;
+
+    while(i < n){
+        BtreePath path;
+        uint32_t leafPageNum, version;
+        LeafCell<T> high;
+        bool bounded;
+        LeafNode<T>* leaf = FindLeaf(cells[i].key, cells[i].rowId, path, leafPageNum, version, &high, &bounded);
+        if(!leaf) continue;
+
+        uint32_t room = LEAF_NODE_MAX_CELLS - min<uint32_t>(leaf->header.numCells, LEAF_NODE_MAX_CELLS); // checked by TryUpgrade
+        uint32_t end = i;
+        while(end < n && end - i < room && (!bounded || less(cells[end], high))) end++;
+
+        if(end == i){
+            bool full = Validate(leaf, version);
+            pager->UnpinPage(leafPageNum);
+            if(full){
+                InsertLocked(cells[i].key, cells[i].rowId);
+                i++;
+            }
+            continue;
+        }
+
+        bool latched = TryUpgrade(leaf, version);
+        if(latched){
+            LeafNodeMerge(leaf, cells + i, end - i);
+            if(leaf->nextLeaf == 0) lastLeaf.store(leafPageNum, memory_order_relaxed);
+            pager->MarkDirty(leafPageNum);
+            WriteUnlock(leaf, 1);
+            i = end;
+        }
+        pager->UnpinPage(leafPageNum);
+    }
+}
 
-    InsertResult<T> res = LeafNodeInsert(leaf, key, rowId);
-    if(res.didSplit){
-        if(leaf->header.isRoot) CreateNewRoot((NodeHeader*)leaf, res.splitKey, res.splitRowId, res.rightChildPageNum);
-        else InsertIntoParent((NodeHeader*)leaf, res.splitKey, res.splitRowId, res.rightChildPageNum);
-    } 
+// Inserts into the last leaf without a descent when it has room and (key, rowId) sorts
+// after its first cell, as ids counting up do: the last leaf holds every cell from there on.
+// The hint may be stale, the leaf split or merged away since; checked under its latch.
+template<typename T>
+bool Btree<T>::AppendToLastLeaf(T key, uint32_t rowId){
+    uint32_t pageNum = lastLeaf.load(memory_order_relaxed);
+    LeafNode<T>* leaf = (LeafNode<T>*)pager->PinFrame(pageNum);
+    uint32_t version = ReadVersion(leaf);
+
+    uint16_t n = leaf->header.numCells;
+    bool fits = leaf->header.type == LEAF && leaf->nextLeaf == 0 && n > 0 && n < LEAF_NODE_MAX_CELLS
+        && (leaf->keys[0] < key || (leaf->keys[0] == key && leaf->rowIds[0] < rowId));
+
+    bool latched = fits && TryUpgrade(leaf, version);
+    if(latched){
+        LeafNodeInsertNonFull(leaf, key, rowId);
+        pager->MarkDirty(pageNum);
+        WriteUnlock(leaf, 1);
+    }
+    pager->UnpinPage(pageNum);
+    return latched;
 }
 
 template<typename T>
 void Btree<T>::SelectRangeLogic(T L, T R, vector<uint32_t>& outRowIds){
-    uint32_t leafPageNum = FindLeaf(rootPageNum, L, 0);
+    auto select = [&](BtreeCursor& cursor){
+        uint32_t rowIds[LEAF_NODE_MAX_CELLS];
+        while(uint32_t n = cursor.Next(rowIds, LEAF_NODE_MAX_CELLS)) outRowIds.insert(outRowIds.end(), rowIds, rowIds + n);
+    };
+
+    if(Buffered(L, R)){
+        MergeCursor cursor(this, L, R);
+        select(cursor);
+    }
+    else{
+        Cursor cursor(this, L, R);
+        select(cursor);
+    }
+}
 
-    bool firstPage = 1;
-    
-    while(leafPageNum != 0 || (firstPage && leafPageNum == 0)){
-        LeafNode<T>* leaf = (LeafNode<T>*)pager->GetPage(leafPageNum, 0);
-        LeafNodeSelectRange(leaf, L, R, outRowIds);
+template<typename T>
+uint32_t Btree<T>::CountRangeLogic(T L, T R){
+    uint32_t count = 0;
+    auto countAll = [&](BtreeCursor& cursor){
+        uint32_t rowIds[LEAF_NODE_MAX_CELLS];
+        while(uint32_t n = cursor.Next(rowIds, LEAF_NODE_MAX_CELLS)) count += n;
+    };
+
+    if(Buffered(L, R)){
+        MergeCursor cursor(this, L, R);
+        countAll(cursor);
+    }
+    else{
+        Cursor cursor(this, L, R);
+        countAll(cursor);
+    }
+    return count;
+}
 
-        if(leaf->header.numCells > 0){
-            T lastKey = leaf->cells[leaf->header.numCells - 1].key;
-            if(lastKey > R) break;
+template<typename T>
+Btree<T>::Cursor::Cursor(Btree<T>* tree, T L, T R)
+    : tree(tree), L(L), R(R), lastKey(L), lastRowId(0), resumed(0), done(0), positioned(0), leafPageNum(0), version(0), slot(0), lastPrefetched(0)
+{
+
+}
+
+// Deletes remove cells from the tree, so every cell is a live row and a range
+// is answered from the leaves alone, without reading the heap.
+// The walk takes no latch: a leaf's cells are copied out and handed over once the leaf
+// validated. If a writer changed it, or the chain moved before the next leaf was
+// reached, the walk descends again and resumes after the last cell it handed out.
+template<typename T>
+void Btree<T>::Cursor::Seek(T key, uint32_t rowId){
+    lastKey = key;
+    lastRowId = rowId;
+    resumed = 1;
+    done = 0;
+    positioned = 0;
+}
+
+template<typename T>
+uint32_t Btree<T>::Cursor::Next(uint32_t* outRowIds, uint32_t max){
+    return NextCells(outRowIds, nullptr, max);
+}
+
+template<typename T>
+uint32_t Btree<T>::Cursor::NextCells(uint32_t* outRowIds, T* outKeys, uint32_t max){
+    Pager* pager = tree->pager;
+    uint32_t count = 0;
+    LeafNode<T>* leaf = nullptr;
+
+    while(count < max && !done){
+        bool seek = 0; // the leaf was just found, slot is not known yet
+        if(!leaf && positioned){
+            leaf = (LeafNode<T>*)pager->PinFrame(leafPageNum);
+            if(ReadVersion(leaf) != version){
+                pager->UnpinPage(leafPageNum);
+                leaf = nullptr;
+                positioned = 0;
+            }
+        }
+        if(!leaf){
+            leaf = tree->FindLeaf(lastKey, lastRowId, path, leafPageNum, version);
+            if(!leaf) continue;
+            lastPrefetched = leafPageNum;
+            seek = 1;
+        }
+
+        uint16_t n = min<uint16_t>(leaf->header.numCells, LEAF_NODE_MAX_CELLS); // a torn read fails Validate below
+        uint16_t from = slot;
+        if(seek) from = resumed ? UpperBound(leaf->keys, leaf->rowIds, n, lastKey, lastRowId) : KeyRank(leaf->keys, n, L, false);
+        from = min(from, n);
+        uint16_t to = from + KeyRankNear(leaf->keys + from, n - from, R, true);
+
+        // hint only when the range goes on past this leaf, never for a lookup
+        if(to == n && leafPageNum == lastPrefetched) lastPrefetched = tree->PrefetchSiblings(path, leaf, leafPageNum, R);
+
+        uint16_t take = min<uint32_t>(to - from, max - count);
+        memcpy(outRowIds + count, leaf->rowIds + from, take * sizeof(uint32_t));
+        if(outKeys) memcpy((void*)(outKeys + count), leaf->keys + from, take * sizeof(T));
+        T toKey = take ? leaf->keys[from + take - 1] : lastKey;
+        uint32_t nextLeaf = leaf->nextLeaf;
+
+        if(!Validate(leaf, version)){
+            pager->UnpinPage(leafPageNum);
+            leaf = nullptr;
+            positioned = 0;
+            continue;
+        }
+
+        if(take){
+            count += take;
+            lastKey = toKey;
+            lastRowId = outRowIds[count - 1];
+            resumed = 1;
+        }
+        positioned = 1;
+        slot = from + take;
+
+        if(slot < to) break; // out of room, the rest of this leaf goes next call
+        if(to < n || nextLeaf == 0){
+            done = 1;
+            break;
         }
-        firstPage = 0;
-        leafPageNum = leaf->nextLeaf;
+
+        // the next leaf is only ours if this one still links to it once its version is read
+        LeafNode<T>* next = (LeafNode<T>*)pager->PinFrame(nextLeaf);
+        uint32_t nextVersion = ReadVersion(next);
+        bool linked = Validate(leaf, version);
+        pager->UnpinPage(leafPageNum);
+        if(!linked){
+            pager->UnpinPage(nextLeaf);
+            leaf = nullptr;
+            positioned = 0;
+            continue;
+        }
+
+        leaf = next;
+        leafPageNum = nextLeaf;
+        version = nextVersion;
+        slot = 0;
     }
+
+    if(leaf) pager->UnpinPage(leafPageNum);
+    return count;
+}
+
+template<typename T>
+Btree<T>::MergeCursor::MergeCursor(Btree<T>* tree, T L, T R)
+    : tree(tree), L(L), R(R), cursor(tree, L, R), flushes(tree->flushes), pos(0), count(0), treeDone(0), last(), started(0)
+{
+
+}
+
+// Two sorted streams, the tree's read ahead a leaf at a time. A flush between calls
+// moves pending cells into the tree, maybe behind the cells read ahead: those are
+// dropped and the tree is read again after the last cell handed out.
+template<typename T>
+uint32_t Btree<T>::MergeCursor::Next(uint32_t* outRowIds, uint32_t max){
+    if(tree->flushes != flushes){
+        flushes = tree->flushes;
+        pos = count = 0;
+        treeDone = 0;
+        if(started) cursor.Seek(last.key, last.rowId);
+        else cursor = Cursor(tree, L, R);
+    }
+
+    CellLess<T> less;
+    auto ins = started ? tree->pendingInserts.upper_bound(last) : tree->pendingInserts.lower_bound({L, 0});
+    uint32_t n = 0;
+
+    while(n < max){
+        if(pos == count && !treeDone){
+            count = cursor.NextCells(rowIds, keys, LEAF_NODE_MAX_CELLS);
+            pos = 0;
+            treeDone = count == 0;
+        }
+
+        bool fromTree = pos < count;
+        bool fromBuffer = ins != tree->pendingInserts.end() && ins->key <= R;
+        if(!fromTree && !fromBuffer) break;
+
+        LeafCell<T> cell;
+        if(fromTree && (!fromBuffer || less({keys[pos], rowIds[pos]}, *ins))){
+            cell = {keys[pos], rowIds[pos]};
+            pos++;
+            if(tree->pendingDeletes.count(cell)) continue;
+        }
+        else cell = *ins++;
+
+        outRowIds[n++] = cell.rowId;
+        last = cell;
+        started = 1;
+    }
+    return n;
 }
 
 template<typename T>
 uint32_t Btree<T>::DeleteRangeLogic(T L, T R){
-    uint32_t leafPageNum = FindLeaf(rootPageNum,L,0);
-    uint32_t deletedCount = 0;
-    bool firstPage = 1;
-    
-    while(leafPageNum != 0 || (firstPage && leafPageNum == 0)){
-        LeafNode<T>* leaf = (LeafNode<T>*)pager->GetPage(leafPageNum, 0); 
-        deletedCount += LeafNodeDeleteRange(leaf, L, R);
+    // collect first: deleting a row removes its cells from every index on the table,
+    // this one included, which can merge or free the leaves being walked
+    vector<uint32_t> rowIds;
+    SelectRangeLogic(L, R, rowIds);
+
+    for(uint32_t rowId : rowIds) table->DeleteRow(rowId);
+    return rowIds.size();
+}
 
-        if(leaf->header.numCells > 0){
-            T lastKey = leaf->cells[leaf->header.numCells - 1].key;
-            if(lastKey > R) break;
+// Optimistic like InsertLogic: when the leaf stays at least half full (or is the root)
+// it is the only node written. Otherwise DeleteLocked.
+template<typename T>
+bool Btree<T>::DeleteLogic(T key, uint32_t rowId){
+    while(true){
+        BtreePath path;
+        uint32_t leafPageNum, version;
+        LeafNode<T>* leaf = FindLeaf(key, rowId, path, leafPageNum, version);
+        if(!leaf) continue;
+
+        if(leaf->header.isRoot || leaf->header.numCells > LEAF_NODE_MIN_CELLS){
+            bool latched = TryUpgrade(leaf, version);
+            bool found = 0;
+            if(latched){
+                found = LeafNodeRemove(leaf, key, rowId);
+                if(found) pager->MarkDirty(leafPageNum);
+                WriteUnlock(leaf, found);
+            }
+            pager->UnpinPage(leafPageNum);
+            if(latched) return found;
+            continue;
         }
-        firstPage = 0;
-        leafPageNum = leaf->nextLeaf;
+
+        bool underflows = Validate(leaf, version);
+        pager->UnpinPage(leafPageNum);
+        if(underflows) break;
     }
 
-    return deletedCount;
+    return DeleteLocked(key, rowId);
+}
 
+template<typename T>
+bool Btree<T>::DeleteLocked(T key, uint32_t rowId){
+    BtreePath path;
+    WriteSet ws;
+    uint32_t leafPageNum = FindLeafLocked(key, rowId, path, ws, 0);
+    LeafNode<T>* leaf = (LeafNode<T>*)LockPage(ws, leafPageNum);
+
+    bool found = LeafNodeRemove(leaf, key, rowId);
+    if(found && !leaf->header.isRoot && leaf->header.numCells < LEAF_NODE_MIN_CELLS) RebalanceLeaf(path, leafPageNum, ws);
+    ReleaseAll(ws);
+    return found;
 }
 
+template<typename T>
+bool Btree<T>::LeafNodeRemove(LeafNode<T>* node, T key, uint32_t rowId){
+    uint16_t slot = LeafNodeFindSlot(node, key, rowId); // first cell after (key, rowId)
+    if(slot == 0 || node->keys[slot-1] != key || node->rowIds[slot-1] != rowId) return 0;
+    slot--;
+
+    uint16_t cellsToMove = node->header.numCells - slot - 1;
+    MoveCells(node, slot, node, slot+1, cellsToMove);
+    node->header.numCells--;
+    return 1;
+}
 
+// A leaf fell below half full: take a cell from a sibling under the same parent
+// if it can spare one, otherwise merge the two and drop their separator.
+// Separators only bound their children, so they change only when cells move between nodes.
+// The parent is the last node on the path down to the leaf, latched with it; the sibling
+// is latched here, under the parent.
 template<typename T>
-uint32_t Btree<T>::FindLeaf(uint32_t pageNum, T key, uint32_t rowId){
-    void* node = pager->GetPage(pageNum, 0);
-    NodeHeader* header = (NodeHeader*) node;
+void Btree<T>::RebalanceLeaf(BtreePath& path, uint32_t pageNum, WriteSet& ws){
+    LeafNode<T>* node = (LeafNode<T>*)LockPage(ws, pageNum);
+    uint32_t parentPageNum = path.nodes[path.depth-1].pageNum;
+    InternalNode<T>* parent = (InternalNode<T>*)LockPage(ws, parentPageNum);
+
+    uint16_t idx = path.nodes[path.depth-1].childIdx;
+    bool fromLeft = idx > 0;
+    uint16_t sep = fromLeft ? idx-1 : idx; // separator between node and sibling
+    uint32_t siblingPageNum = ChildAt(parent, fromLeft ? idx-1 : idx+1);
+    LeafNode<T>* sibling = (LeafNode<T>*)LockPage(ws, siblingPageNum);
+
+    if(sibling->header.numCells > LEAF_NODE_MIN_CELLS){
+        if(fromLeft){
+            MoveCells(node, 1, node, 0, node->header.numCells);
+            MoveCells(node, 0, sibling, --sibling->header.numCells, 1);
+            node->header.numCells++;
+            parent->keys[sep] = node->keys[0];
+            parent->rowIds[sep] = node->rowIds[0];
+        }
+        else{
+            MoveCells(node, node->header.numCells++, sibling, 0, 1);
+            MoveCells(sibling, 0, sibling, 1, --sibling->header.numCells);
+            parent->keys[sep] = sibling->keys[0];
+            parent->rowIds[sep] = sibling->rowIds[0];
+        }
+        return;
+    }
 
-    if(header->type==LEAF) return pageNum;
+    LeafNode<T>* left = fromLeft ? sibling : node;
+    LeafNode<T>* right = fromLeft ? node : sibling;
+    uint32_t rightPageNum = fromLeft ? pageNum : siblingPageNum;
 
-    InternalNode<T>* internal = (InternalNode<T>*) node;
-    uint32_t childPageNum = InternalNodeFindChild(internal, key, rowId);
-    
-    return FindLeaf(childPageNum, key, rowId); 
+    MoveCells(left, left->header.numCells, right, 0, right->header.numCells);
+    left->header.numCells += right->header.numCells;
+    left->nextLeaf = right->nextLeaf;
+    RemoveSeparator(parent, sep);
+
+    ws.freed[ws.freedCount++] = rightPageNum;
+    RebalanceInternal(path, ws);
+}
+
+// Same as RebalanceLeaf one level up, for the last node on the path, which is popped:
+// borrowing rotates a child through the parent's separator, merging pulls the separator
+// down between the two nodes' cells. A root left with a single child is collapsed instead.
+template<typename T>
+void Btree<T>::RebalanceInternal(BtreePath& path, WriteSet& ws){
+    uint32_t pageNum = path.nodes[--path.depth].pageNum;
+    InternalNode<T>* node = (InternalNode<T>*)LockPage(ws, pageNum);
+    if(node->header.isRoot){
+        if(node->header.numCells == 0) CollapseRoot(ws);
+        return;
+    }
+    if(node->header.numCells >= INTERNAL_NODE_MIN_CELLS) return;
+
+    uint32_t parentPageNum = path.nodes[path.depth-1].pageNum;
+    InternalNode<T>* parent = (InternalNode<T>*)LockPage(ws, parentPageNum);
+
+    uint16_t idx = path.nodes[path.depth-1].childIdx;
+    bool fromLeft = idx > 0;
+    uint16_t sep = fromLeft ? idx-1 : idx;
+    uint32_t siblingPageNum = ChildAt(parent, fromLeft ? idx-1 : idx+1);
+    InternalNode<T>* sibling = (InternalNode<T>*)LockPage(ws, siblingPageNum);
+
+    if(sibling->header.numCells > INTERNAL_NODE_MIN_CELLS){
+        if(fromLeft){
+            uint16_t last = sibling->header.numCells - 1;
+
+            MoveCells(node, 1, node, 0, node->header.numCells);
+            node->keys[0] = parent->keys[sep];
+            node->rowIds[0] = parent->rowIds[sep];
+            node->childPages[0] = sibling->rightChild;
+            node->header.numCells++;
+
+            parent->keys[sep] = sibling->keys[last];
+            parent->rowIds[sep] = sibling->rowIds[last];
+            sibling->rightChild = sibling->childPages[last];
+            sibling->header.numCells--;
+        }
+        else{
+            uint16_t n = node->header.numCells;
+
+            node->keys[n] = parent->keys[sep];
+            node->rowIds[n] = parent->rowIds[sep];
+            node->childPages[n] = node->rightChild;
+            node->rightChild = sibling->childPages[0];
+            node->header.numCells++;
+
+            parent->keys[sep] = sibling->keys[0];
+            parent->rowIds[sep] = sibling->rowIds[0];
+            MoveCells(sibling, 0, sibling, 1, --sibling->header.numCells);
+        }
+        return;
+    }
+
+    InternalNode<T>* left = fromLeft ? sibling : node;
+    InternalNode<T>* right = fromLeft ? node : sibling;
+    uint32_t rightPageNum = fromLeft ? pageNum : siblingPageNum;
+
+    uint16_t n = left->header.numCells;
+    left->keys[n] = parent->keys[sep];
+    left->rowIds[n] = parent->rowIds[sep];
+    left->childPages[n] = left->rightChild;
+    MoveCells(left, n+1, right, 0, right->header.numCells);
+    left->header.numCells += right->header.numCells + 1;
+    left->rightChild = right->rightChild;
+    RemoveSeparator(parent, sep);
+
+    ws.freed[ws.freedCount++] = rightPageNum;
+    RebalanceInternal(path, ws);
+}
+
+// Drops cells[idx] after its two children were merged into the left one
+template<typename T>
+void Btree<T>::RemoveSeparator(InternalNode<T>* parent, uint16_t idx){
+    uint32_t leftPageNum = parent->childPages[idx];
+
+    uint16_t cellsToMove = parent->header.numCells - idx - 1;
+    MoveCells(parent, idx, parent, idx+1, cellsToMove);
+    parent->header.numCells--;
+
+    SetChildAt(parent, idx, leftPageNum); // where the right child was
+}
+
+// The root has one child left: move that child into page 0 and free its page.
+// The child is the node its last two children were just merged into, already latched.
+template<typename T>
+void Btree<T>::CollapseRoot(WriteSet& ws){
+    InternalNode<T>* root = (InternalNode<T>*)LockPage(ws, rootPageNum);
+    uint32_t childPageNum = root->rightChild;
+    void* child = LockPage(ws, childPageNum);
+
+    {
+        lock_guard<mutex> lock(allocMutex); // nextFree belongs to the allocator
+        uint32_t freeHead = root->header.nextFree;
+        CopyNode(root, child);
+        root->header.isRoot = 1;
+        root->header.nextFree = freeHead;
+    }
+
+    ws.freed[ws.freedCount++] = childPageNum;
+}
+
+template<typename T>
+uint32_t Btree<T>::ChildAt(InternalNode<T>* node, uint16_t idx){
+    if(idx == node->header.numCells) return node->rightChild;
+    return node->childPages[idx];
+}
+
+template<typename T>
+void Btree<T>::SetChildAt(InternalNode<T>* node, uint16_t idx, uint32_t childPageNum){
+    if(idx == node->header.numCells) node->rightChild = childPageNum;
+    else node->childPages[idx] = childPageNum;
+}
+
+// Page for a new node: the head of the free-page list, or a new page at the end of the file.
+// It is latched under allocMutex, which also makes a new page part of the file before another
+// writer can take the same number. Nobody holds a free page's latch (see WriteSet), so this never waits.
+template<typename T>
+uint32_t Btree<T>::AllocatePage(WriteSet& ws){
+    lock_guard<mutex> lock(allocMutex);
+    NodeHeader* root = (NodeHeader*)pager->PinFrame(rootPageNum);
+
+    uint32_t pageNum = root->nextFree;
+    if(pageNum == 0){
+        pageNum = pager->numPages;
+        LockPage(ws, pageNum);
+    }
+    else{
+        root->nextFree = ((NodeHeader*)LockPage(ws, pageNum))->nextFree;
+        pager->MarkDirty(rootPageNum);
+    }
+
+    pager->UnpinPage(rootPageNum);
+    return pageNum;
+}
+
+// Called once the writer released the page, which nothing links to anymore
+template<typename T>
+void Btree<T>::FreePage(uint32_t pageNum){
+    lock_guard<mutex> lock(allocMutex);
+    NodeHeader* root = (NodeHeader*)pager->PinFrame(rootPageNum);
+    NodeHeader* freed = (NodeHeader*)pager->PinFrame(pageNum);
+
+    WriteLock(freed);
+    freed->type = LEAF;
+    freed->isRoot = 0;
+    freed->numCells = 0;
+    freed->nextFree = root->nextFree;
+    WriteUnlock(freed, 1);
+    root->nextFree = pageNum;
+
+    pager->MarkDirty(pageNum);
+    pager->MarkDirty(rootPageNum);
+    pager->UnpinPage(pageNum);
+    pager->UnpinPage(rootPageNum);
+}
+
+template<typename T>
+atomic_ref<uint32_t> Btree<T>::Version(void* node){
+    return atomic_ref<uint32_t>(((LeafNode<T>*)node)->version);
+}
+
+template<typename T>
+uint32_t Btree<T>::ReadVersion(void* node){
+    uint32_t version = Version(node).load(memory_order_acquire);
+    while(version & NODE_LOCKED){
+        this_thread::yield();
+        version = Version(node).load(memory_order_acquire);
+    }
+    return version;
+}
+
+template<typename T>
+bool Btree<T>::Validate(void* node, uint32_t version){
+    atomic_thread_fence(memory_order_acquire); // the node was read before the version is checked
+    return Version(node).load(memory_order_relaxed) == version;
+}
+
+template<typename T>
+bool Btree<T>::TryUpgrade(void* node, uint32_t version){
+    if(!Version(node).compare_exchange_strong(version, version | NODE_LOCKED, memory_order_acquire)) return 0;
+    atomic_thread_fence(memory_order_release); // the latch is visible before anything written under it
+    return 1;
+}
+
+template<typename T>
+void Btree<T>::WriteLock(void* node){
+    while(!TryUpgrade(node, ReadVersion(node)));
+}
+
+template<typename T>
+void Btree<T>::WriteUnlock(void* node, bool changed){
+    if(changed) Version(node).fetch_add(1, memory_order_release); // past the locked value, to the next version
+    else Version(node).fetch_sub(1, memory_order_release);
+}
+
+template<typename T>
+bool Btree<T>::IsSafe(void* node, bool inserting){
+    NodeHeader* h = (NodeHeader*)node;
+    bool leaf = h->type == LEAF;
+    if(inserting) return h->numCells < (leaf ? LEAF_NODE_MAX_CELLS : INTERNAL_NODE_MAX_CELLS);
+    if(h->isRoot) return leaf || h->numCells > 1;
+    return h->numCells > (leaf ? LEAF_NODE_MIN_CELLS : INTERNAL_NODE_MIN_CELLS);
+}
+
+// Pins and latches a page for the writer; a page it already holds is returned as is
+template<typename T>
+void* Btree<T>::LockPage(WriteSet& ws, uint32_t pageNum){
+    for(uint32_t i = 0; i < ws.count; i++){
+        if(ws.pageNums[i] == pageNum) return ws.nodes[i];
+    }
+
+    if(ws.count == WRITE_SET_PAGES){
+        cerr << "Error: Too many latched pages in index " << pager->fileName << endl;
+        exit(1);
+    }
+
+    void* node = pager->PinFrame(pageNum);
+    WriteLock(node);
+    ws.pageNums[ws.count] = pageNum;
+    ws.nodes[ws.count++] = node;
+    return node;
+}
+
+template<typename T>
+void Btree<T>::ReleaseAbove(WriteSet& ws){
+    uint32_t last = ws.count - 1;
+    for(uint32_t i = 0; i < last; i++){
+        WriteUnlock(ws.nodes[i], 0);
+        pager->UnpinPage(ws.pageNums[i]);
+    }
+
+    ws.pageNums[0] = ws.pageNums[last];
+    ws.nodes[0] = ws.nodes[last];
+    ws.count = 1;
+}
+
+template<typename T>
+void Btree<T>::ReleaseAll(WriteSet& ws){
+    for(uint32_t i = 0; i < ws.count; i++){
+        pager->MarkDirty(ws.pageNums[i]);
+        WriteUnlock(ws.nodes[i], 1);
+        pager->UnpinPage(ws.pageNums[i]);
+    }
+    ws.count = 0;
+
+    for(uint32_t i = 0; i < ws.freedCount; i++) FreePage(ws.freed[i]);
+    ws.freedCount = 0;
+}
+
+// Reads the leaves after this one under the same parent that can hold keys <= R (up to
+// READ_BATCH_PAGES) in one batch, so the leaf chain is in the pool ahead of the scan. The
+// path ends at the leaf's parent and follows the walk: it is left at the leaf to read from
+// next, which is returned. Only read-ahead: the parent is read like any node, but a writer
+// in the way just ends it (0).
+template<typename T>
+uint32_t Btree<T>::PrefetchSiblings(BtreePath& path, LeafNode<T>* leaf, uint32_t leafPageNum, T R){
+    if(path.depth == 0) return leafPageNum; // the root is a leaf
+
+    PathEntry& up = path.nodes[path.depth-1];
+    InternalNode<T>* parent = (InternalNode<T>*)pager->PinFrame(up.pageNum);
+    uint32_t version = ReadVersion(parent);
+    uint16_t n = min<uint16_t>(parent->header.numCells, INTERNAL_NODE_MAX_CELLS);
+
+    // child k only holds keys >= keys[k-1]
+    vector<uint32_t> pages;
+    uint16_t k = up.childIdx + 1;
+    for(; k <= n && parent->keys[k - 1] <= R && pages.size() < Pager::READ_BATCH_PAGES; k++) pages.push_back(k == n ? parent->rightChild : parent->childPages[k]);
+
+    bool valid = Validate(parent, version);
+    pager->UnpinPage(up.pageNum);
+    if(!valid) return 0;
+
+    if(pages.empty()){
+        // hint again from the next leaf, the last child's is the first one of the next parent
+        if(up.childIdx < n) up.childIdx++;
+        else if(!NextParent(path)) return 0;
+        return leaf->nextLeaf;
+    }
+
+    up.childIdx = k - 1;
+    uint32_t last = pages.back();
+    pager->ReadPages(pages.data(), pages.size());
+    return last;
+}
+
+// Moves the last node on the path to the next node on its level, at its first child.
+// False if it was the last one, or if a writer changed a node on the way.
+template<typename T>
+bool Btree<T>::NextParent(BtreePath& path){
+    // climb to the nearest node with a child after the one taken
+    int32_t d = path.depth - 1;
+    while(true){
+        if(--d < 0) return false;
+
+        InternalNode<T>* node = (InternalNode<T>*)pager->PinFrame(path.nodes[d].pageNum);
+        uint32_t version = ReadVersion(node);
+        bool last = path.nodes[d].childIdx >= node->header.numCells;
+        bool valid = Validate(node, version);
+        pager->UnpinPage(path.nodes[d].pageNum);
+
+        if(!valid) return false;
+        if(!last) break;
+    }
+
+    path.nodes[d].childIdx++;
+    for(; d + 1 < (int32_t)path.depth; d++){
+        InternalNode<T>* node = (InternalNode<T>*)pager->PinFrame(path.nodes[d].pageNum);
+        uint32_t version = ReadVersion(node);
+        uint16_t idx = path.nodes[d].childIdx;
+        uint32_t child = idx >= node->header.numCells ? node->rightChild : node->childPages[idx];
+        bool valid = Validate(node, version);
+        pager->UnpinPage(path.nodes[d].pageNum);
+
+        if(!valid) return false;
+        path.nodes[d+1] = {child, 0};
+    }
+    return true;
+}
+
+// Descends from the root to the leaf where (key, rowId) belongs, recording the path,
+// without latching anything. A child pointer is followed only once its node validated,
+// and the node is checked again after the child's version is read, so the child was
+// still its child at that version. Returns the leaf pinned and the version it was read
+// at, or nullptr with nothing pinned if a writer got in the way and the caller must retry.
+// With high, also the separator every cell of the leaf is below (bounded, unless it is the
+// last leaf). It holds as long as the leaf keeps that version: only a split, merge or borrow
+// moves it, and those latch the leaf.
+template<typename T>
+LeafNode<T>* Btree<T>::FindLeaf(T key, uint32_t rowId, BtreePath& path, uint32_t& leafPageNum, uint32_t& version, LeafCell<T>* high, bool* bounded){
+    if(bounded) *bounded = 0;
+    path.depth = 0;
+    uint32_t pageNum = rootPageNum;
+    void* node = pager->PinFrame(pageNum);
+    uint32_t v = ReadVersion(node);
+
+    while(((NodeHeader*)node)->type == INTERNAL){
+        InternalNode<T>* internal = (InternalNode<T>*) node;
+        uint16_t n = min<uint16_t>(internal->header.numCells, INTERNAL_NODE_MAX_CELLS);
+        uint16_t idx = UpperBound(internal->keys, internal->rowIds, n, key, rowId);
+        uint32_t childPageNum = idx == n ? internal->rightChild : internal->childPages[idx];
+        // the separator after the child, deeper ones are tighter
+        if(high && idx < n){
+            *high = {internal->keys[idx], internal->rowIds[idx]};
+            *bounded = 1;
+        }
+
+        if(!Validate(node, v)){
+            pager->UnpinPage(pageNum);
+            return nullptr;
+        }
+
+        if(path.depth == BTREE_MAX_DEPTH){
+            cerr << "Error: Index " << pager->fileName << " is deeper than " << BTREE_MAX_DEPTH << " levels" << endl;
+            exit(1);
+        }
+        path.nodes[path.depth++] = {pageNum, idx};
+
+        void* child = pager->PinFrame(childPageNum);
+        uint32_t childVersion = ReadVersion(child);
+        bool valid = Validate(node, v);
+        pager->UnpinPage(pageNum);
+        if(!valid){
+            pager->UnpinPage(childPageNum);
+            return nullptr;
+        }
+
+        pageNum = childPageNum;
+        node = child;
+        v = childVersion;
+    }
+
+    leafPageNum = pageNum;
+    version = v;
+    return (LeafNode<T>*)node;
+}
+
+// Same descent with write latches, coupled: a child is latched before its parent is let go.
+// Once a node is safe, the operation cannot change anything above it (an insert cannot split
+// it, a delete cannot empty it below half), so every latch above it is released.
+// The path still records the released nodes, but splits and merges stop before reaching them.
+template<typename T>
+uint32_t Btree<T>::FindLeafLocked(T key, uint32_t rowId, BtreePath& path, WriteSet& ws, bool inserting){
+    path.depth = 0;
+    uint32_t pageNum = rootPageNum;
+    void* node = LockPage(ws, pageNum);
+
+    while(((NodeHeader*)node)->type == INTERNAL){
+        if(path.depth == BTREE_MAX_DEPTH){
+            cerr << "Error: Index " << pager->fileName << " is deeper than " << BTREE_MAX_DEPTH << " levels" << endl;
+            exit(1);
+        }
+
+        InternalNode<T>* internal = (InternalNode<T>*) node;
+        uint16_t idx = UpperBound(internal->keys, internal->rowIds, internal->header.numCells, key, rowId);
+        path.nodes[path.depth++] = {pageNum, idx};
+
+        pageNum = ChildAt(internal, idx);
+        node = LockPage(ws, pageNum);
+        if(IsSafe(node, inserting)) ReleaseAbove(ws);
+    }
+    return pageNum;
 }
 
 template<typename T>
 void Btree<T>::InitializeLeafNode(LeafNode<T>* node){
+    // the latch is left alone, a writer may hold it
+    memset(node, 0, offsetof(LeafNode<T>, version));
+    memset(node->keys, 0, sizeof(LeafNode<T>) - offsetof(LeafNode<T>, keys));
     node->header.type = LEAF;
     node->header.isRoot = 0;
     node->header.numCells = 0;
-    node->header.parent = 0;
+    node->header.nextFree = 0;
 
 
     node->nextLeaf = 0;
+}
 
-    memset(node->cells, 0, LEAF_NODE_SIZE - HEADER_SIZE);
+template<typename T>
+void Btree<T>::CopyNode(void* dest, const void* src){
+    uint32_t latch = offsetof(LeafNode<T>, version);
+    uint32_t rest = latch + sizeof(uint32_t);
+    memcpy(dest, src, latch);
+    memcpy((char*)dest + rest, (const char*)src + rest, BTREE_NODE_SIZE - rest);
 }
 
 template<typename T>
@@ -138,203 +1083,203 @@ bool Btree<T>::LeafNodeInsertNonFull(LeafNode<T>* node, T key, uint32_t rowId){
     
     uint16_t cellsToMove = node->header.numCells - slot;
     if(cellsToMove > 0){
-        void* src = &node->cells[slot];
-        void* dest = &node->cells[slot+1];
-        memmove(dest, src, cellsToMove*LEAF_CELL_SIZE);
+        MoveCells(node, slot+1, node, slot, cellsToMove);
     }
     node->header.numCells++;
-    node->cells[slot].key = key;
-    node->cells[slot].rowId = rowId;  
+    node->keys[slot] = key;
+    node->rowIds[slot] = rowId;  
 
     return 1;
 }
 
 
+// Merges from the back, so every cell of the node moves once.
+template<typename T>
+void Btree<T>::LeafNodeMerge(LeafNode<T>* node, const LeafCell<T>* cells, uint16_t count){
+    CellLess<T> less;
+    int32_t a = node->header.numCells - 1;
+    int32_t b = count - 1;
+
+    for(int32_t w = a + count; b >= 0; w--){
+        if(a >= 0 && less(cells[b], {node->keys[a], node->rowIds[a]})){
+            node->keys[w] = node->keys[a];
+            node->rowIds[w] = node->rowIds[a];
+            a--;
+        }
+        else{
+            node->keys[w] = cells[b].key;
+            node->rowIds[w] = cells[b].rowId;
+            b--;
+        }
+    }
+    node->header.numCells += count;
+}
+
 template<typename T>
-InsertResult<T> Btree<T>::LeafNodeInsert(LeafNode<T>* node, T key, uint32_t rowId){
+InsertResult<T> Btree<T>::LeafNodeInsert(LeafNode<T>* node, T key, uint32_t rowId, WriteSet& ws){
     T asdf; // a random T object to match InsertResult<T> attributes
-    if(LeafNodeInsertNonFull(node, key, rowId)) return {true, false, asdf, 0, 0};
+    if(LeafNodeInsertNonFull(node, key, rowId)) return {true, false, asdf, 0, 0, false};
 
 
-    uint32_t newPageNum = pager->numPages;
+    // past the end of the last leaf (ids counting up): the full leaf stays full and the
+    // cell starts a new one, so sequential inserts fill leaves instead of leaving them half empty
+    bool append = node->nextLeaf == 0 && LeafNodeFindSlot(node, key, rowId) == node->header.numCells;
+
+    uint32_t newPageNum = AllocatePage(ws);
     
-    LeafNode<T>* rightNode = (LeafNode<T>*) pager->GetPage(newPageNum, 1);
+    LeafNode<T>* rightNode = (LeafNode<T>*) LockPage(ws, newPageNum);
     InitializeLeafNode(rightNode);
     rightNode->header.isRoot = 0;
-    rightNode->header.parent = node->header.parent;
 
     rightNode->nextLeaf = node->nextLeaf;
     node->nextLeaf = newPageNum;
+    if(rightNode->nextLeaf == 0) lastLeaf.store(newPageNum, memory_order_relaxed);
 
-    uint16_t splitIdx = (LEAF_NODE_MAX_CELLS+1)/2;
+    uint16_t splitIdx = append ? node->header.numCells : (LEAF_NODE_MAX_CELLS+1)/2;
     uint16_t cellsMoved = node->header.numCells-splitIdx;
 
-    void* src = &node->cells[splitIdx];
-    void* dest = &rightNode->cells[0];
-    memcpy(dest, src, cellsMoved*LEAF_CELL_SIZE);
+    MoveCells(rightNode, 0, node, splitIdx, cellsMoved);
 
     node->header.numCells = splitIdx;
     rightNode->header.numCells = cellsMoved;
 
-    T splitKey = rightNode->cells[0].key;
-    uint32_t splitRowId = rightNode->cells[0].rowId;
+    if(append){
+        LeafNodeInsertNonFull(rightNode, key, rowId);
+        return {true, true, key, rowId, newPageNum, true};
+    }
 
-    if(key>=splitKey) LeafNodeInsertNonFull(rightNode, key, rowId);
+    T splitKey = rightNode->keys[0];
+    uint32_t splitRowId = rightNode->rowIds[0];
+
+    if(key > splitKey || (key == splitKey && rowId >= splitRowId)) LeafNodeInsertNonFull(rightNode, key, rowId);
     else LeafNodeInsertNonFull(node, key, rowId);
 
 
-    return {true, true, splitKey, splitRowId, newPageNum};
+    return {true, true, splitKey, splitRowId, newPageNum, false};
 
 }
 
 template<typename T>
 uint16_t Btree<T>::LeafNodeFindSlot(LeafNode<T>* node, T targetKey, uint32_t targetRowId){
-    uint16_t l = 0;
-    uint16_t r = node->header.numCells;
+    return UpperBound(node->keys, node->rowIds, node->header.numCells, targetKey, targetRowId);
+}
 
-    while(l<r){
-        uint16_t mid = l+r>>1;
-        T midKey = node->cells[mid].key;
-        uint32_t midRowId = node->cells[mid].rowId;
-        if(targetKey < midKey || (targetKey == midKey && targetRowId < midRowId)) r = mid;
-        else l = mid+1;
-    }
+// First slot whose (key, rowId) is greater than the target. The keys alone narrow it
+// down to the run of cells equal to key, and rowIds within that run are in order.
+template<typename T>
+uint16_t Btree<T>::UpperBound(const T* keys, const uint32_t* rowIds, uint16_t n, T key, uint32_t rowId){
+    uint16_t lo = KeyRank(keys, n, key, false);
+    uint16_t hi = lo + KeyRankNear(keys + lo, n - lo, key, true);
+    return upper_bound(rowIds + lo, rowIds + hi, rowId) - rowIds;
+}
 
-    return l;
+template<typename T>
+void Btree<T>::MoveCells(LeafNode<T>* dest, uint16_t destIdx, LeafNode<T>* src, uint16_t srcIdx, uint16_t count){
+    memmove(&dest->keys[destIdx], &src->keys[srcIdx], count*sizeof(T));
+    memmove(&dest->rowIds[destIdx], &src->rowIds[srcIdx], count*sizeof(uint32_t));
 }
 
 template<typename T>
-void Btree<T>::CreateNewRoot(NodeHeader* root, T splitKey, uint32_t splitRowId, uint32_t rightChildPageNum){
-    pager->MarkDirty(rootPageNum);
+void Btree<T>::MoveCells(InternalNode<T>* dest, uint16_t destIdx, InternalNode<T>* src, uint16_t srcIdx, uint16_t count){
+    memmove(&dest->keys[destIdx], &src->keys[srcIdx], count*sizeof(T));
+    memmove(&dest->rowIds[destIdx], &src->rowIds[srcIdx], count*sizeof(uint32_t));
+    memmove(&dest->childPages[destIdx], &src->childPages[srcIdx], count*sizeof(uint32_t));
+}
 
-    uint32_t leftChildPageNum = pager->numPages;
-    NodeHeader* leftChild = (NodeHeader*)pager->GetPage(leftChildPageNum, 1);
+// The root split: it stays at page 0 and its cells move to a new left child.
+// Only the root and that new page are written, the children keep their pages.
+// The root is latched: a split only reaches it if it was not safe.
+template<typename T>
+void Btree<T>::CreateNewRoot(T splitKey, uint32_t splitRowId, uint32_t rightChildPageNum, WriteSet& ws){
+    NodeHeader* root = (NodeHeader*)LockPage(ws, rootPageNum);
 
-    memcpy(leftChild, root, INTERNAL_NODE_SIZE);
-    leftChild->isRoot = 0;
-    leftChild->parent = 0;
+    uint32_t leftChildPageNum = AllocatePage(ws);
+    NodeHeader* leftChild = (NodeHeader*)LockPage(ws, leftChildPageNum);
 
-    NodeHeader* rightChild = (NodeHeader*)pager->GetPage(rightChildPageNum, 1);
-    rightChild->parent = 0;
+    {
+        lock_guard<mutex> lock(allocMutex); // nextFree belongs to the allocator
+        CopyNode(leftChild, root);
+    }
+    leftChild->isRoot = 0;
+    leftChild->nextFree = 0;
 
     InternalNode<T>* internalRoot = (InternalNode<T>*)root;
     internalRoot->header.type = INTERNAL;
     internalRoot->header.isRoot = 1;
-    internalRoot->header.numCells = 1;
-    internalRoot->header.parent = 0;
+    internalRoot->header.numCells = 1; // nextFree keeps the free-page list
 
     internalRoot->rightChild = rightChildPageNum;
 
-    internalRoot->cells[0].key = splitKey;
-    internalRoot->cells[0].rowId = splitRowId;
-    internalRoot->cells[0].childPage = leftChildPageNum;
-
-    if(leftChild->type == INTERNAL) UpdateChildParents((InternalNode<T>*)leftChild, leftChildPageNum);
-    if(rightChild->type == INTERNAL) UpdateChildParents((InternalNode<T>*)rightChild, rightChildPageNum);
+    internalRoot->keys[0] = splitKey;
+    internalRoot->rowIds[0] = splitRowId;
+    internalRoot->childPages[0] = leftChildPageNum;
 }
 
+// The node at the end of the path split off rightChildPageNum, whose cells start at
+// (key, rowId): add it to the parent one step up, and keep going while parents split.
+// Every parent reached is still latched, since the node below it was not safe.
 template<typename T>
-uint32_t Btree<T>::InternalNodeFindChild(InternalNode<T>* node, T targetKey, uint32_t targetRowId){
-    uint16_t l = 0;
-    uint16_t r = node->header.numCells;
-
-    while(l<r){
-        uint16_t mid = l+r>>1;
-        T midKey = node->cells[mid].key;
-        uint32_t midRowId = node->cells[mid].rowId;
-        if(targetKey < midKey || (targetKey == midKey && targetRowId < midRowId)) r=mid;
-        else l = mid+1;
-    }
-
-    if(l == node->header.numCells) return node->rightChild;
-    return node->cells[l].childPage;
-}
+void Btree<T>::InsertIntoParent(BtreePath& path, T key, uint32_t rowId, uint32_t rightChildPageNum, bool append, WriteSet& ws){
+    while(path.depth > 0){
+        uint32_t parentPageNum = path.nodes[--path.depth].pageNum;
+        InternalNode<T>* parent = (InternalNode<T>*)LockPage(ws, parentPageNum);
+        InsertResult<T> res = InternalNodeInsert(parent, key, rowId, rightChildPageNum, append, ws);
 
-
-template<typename T>
-void Btree<T>::UpdateChildParents(InternalNode<T>* parentNode, uint32_t parentPageNum){
-    void* child = pager->GetPage(parentNode->rightChild, 1);
-    ((NodeHeader*)child)->parent = parentPageNum;
-
-    for(uint16_t i = 0; i<parentNode->header.numCells;i++){
-        void* child = pager->GetPage(parentNode->cells[i].childPage, 1);
-        ((NodeHeader*)child)->parent = parentPageNum;
-    }
-}
-
-template<typename T>
-void Btree<T>::InsertIntoParent(NodeHeader* leftChild, T key, uint32_t rowId, uint32_t rightChildPageNum){
-    uint32_t parentPageNum = leftChild->parent;
-
-    if(parentPageNum == 0){
-        InternalNode<T>* root = (InternalNode<T>*)pager->GetPage(0,1);
-
-        InsertResult<T> res = InternalNodeInsert(root, key, rowId, rightChildPageNum);
         if(!res.didSplit) return;
-
-        CreateNewRoot((NodeHeader*)root, res.splitKey, res.splitRowId, res.rightChildPageNum);
-        
-        return;
+        key = res.splitKey;
+        rowId = res.splitRowId;
+        rightChildPageNum = res.rightChildPageNum;
+        append = res.append;
     }
 
-    InternalNode<T>* parent = (InternalNode<T>*)pager->GetPage(parentPageNum, 1);
-    InsertResult<T> res = InternalNodeInsert(parent, key, rowId, rightChildPageNum);
-
-    if(res.didSplit){
-        InsertIntoParent((NodeHeader*) parent, res.splitKey, res.splitRowId, res.rightChildPageNum);
-    }
+    CreateNewRoot(key, rowId, rightChildPageNum, ws);
 }
 
 template<typename T>
-InsertResult<T> Btree<T>:: InternalNodeInsert(InternalNode<T>* node, T key, uint32_t rowId, uint32_t rightChildPage){
+InsertResult<T> Btree<T>:: InternalNodeInsert(InternalNode<T>* node, T key, uint32_t rowId, uint32_t rightChildPage, bool append, WriteSet& ws){
     if(node->header.numCells < INTERNAL_NODE_MAX_CELLS){
-        uint16_t i = 0;
-        while(i < node->header.numCells){
-            bool targetIsSmaller = (key < node->cells[i].key) || (key == node->cells[i].key && rowId < node->cells[i].rowId);
-            if(targetIsSmaller) break;
-            i++;
-        }
-
-        for(uint16_t j = node->header.numCells; j > i; j--){
-            node->cells[j] = node->cells[j-1];
-        }
+        uint16_t i = UpperBound(node->keys, node->rowIds, node->header.numCells, key, rowId);
+        MoveCells(node, i+1, node, i, node->header.numCells - i);
         
         if(i == node->header.numCells){
-            node->cells[i].key = key;
-            node->cells[i].rowId = rowId;
-            node->cells[i].childPage = node->rightChild;
+            node->keys[i] = key;
+            node->rowIds[i] = rowId;
+            node->childPages[i] = node->rightChild;
             node->rightChild = rightChildPage;
         }
         else{
-            node->cells[i+1].childPage = rightChildPage;
-            node->cells[i].key = key;
-            node->cells[i].rowId = rowId;
+            node->childPages[i+1] = rightChildPage;
+            node->keys[i] = key;
+            node->rowIds[i] = rowId;
         }
 
         node->header.numCells++;
         
         T asdf;
-        return {true, false, asdf, 0, 0};
+        return {true, false, asdf, 0, 0, false};
     }
 
-    uint32_t newPageNum = pager->numPages;
-    InternalNode<T>* rightNode = (InternalNode<T>*)pager->GetPage(newPageNum, 1);
+    uint32_t newPageNum = AllocatePage(ws);
+    InternalNode<T>* rightNode = (InternalNode<T>*)LockPage(ws, newPageNum);
 
     rightNode->header.type = INTERNAL;
     rightNode->header.isRoot = 0;
     rightNode->header.numCells = 0;
-    rightNode->header.parent = node->header.parent;
+    rightNode->header.nextFree = 0;
 
-    uint16_t splitIdx = INTERNAL_NODE_MAX_CELLS/2;
+    // an append split below reached the last node of this level: like the leaf, it stays
+    // full, only its last cell is promoted and the new node starts with the appended one
+    append = append && UpperBound(node->keys, node->rowIds, node->header.numCells, key, rowId) == node->header.numCells;
+    uint16_t splitIdx = append ? INTERNAL_NODE_MAX_CELLS - 1 : INTERNAL_NODE_MAX_CELLS/2;
 
-    T promotedKey = node->cells[splitIdx].key;
-    uint32_t promotedRowId = node->cells[splitIdx].rowId;
+    T promotedKey = node->keys[splitIdx];
+    uint32_t promotedRowId = node->rowIds[splitIdx];
 
-    uint32_t leftNewRightChild = node->cells[splitIdx].childPage;
+    uint32_t leftNewRightChild = node->childPages[splitIdx];
 
     uint16_t cellsMoved = node->header.numCells - splitIdx - 1;
 
-    memcpy(rightNode->cells, &node->cells[splitIdx+1], cellsMoved*INTERNAL_CELL_SIZE);
+    MoveCells(rightNode, 0, node, splitIdx+1, cellsMoved);
 
     rightNode->header.numCells = cellsMoved;
 
@@ -344,45 +1289,93 @@ InsertResult<T> Btree<T>:: InternalNodeInsert(InternalNode<T>* node, T key, uint
 
 
     if(key > promotedKey || (key==promotedKey && rowId > promotedRowId)){
-        InternalNodeInsert(rightNode, key, rowId, rightChildPage);
+        InternalNodeInsert(rightNode, key, rowId, rightChildPage, 0, ws);
     }
     else{
-        InternalNodeInsert(node, key, rowId, rightChildPage);
+        InternalNodeInsert(node, key, rowId, rightChildPage, 0, ws);
     }
 
-    UpdateChildParents(rightNode, newPageNum);
-
-    return {true, true, promotedKey, promotedRowId, newPageNum};
+    return {true, true, promotedKey, promotedRowId, newPageNum, append};
 }
 
+// Every page of the file is either a node reached exactly once from the root or on the
+// free list. Nodes hold sorted cells within the separators above them, no latch is left
+// set, only the root may be empty, leaves all sit at the same depth and are chained in order.
 template<typename T>
-void Btree<T>::LeafNodeSelectRange(LeafNode<T>* node, T L, T R, vector<uint32_t>& outRowIds){
-    for(uint16_t i = 0;i<node->header.numCells;i++){
-        uint32_t rowId = node->cells[i].rowId;
-        if(table->IsRowDeleted(rowId)) continue;
+string Btree<T>::Check(){
+    vector<uint32_t> leaves;
+    vector<bool> seen(pager->numPages, 0);
+    uint32_t leafDepth = UINT32_MAX;
+
+    string error = CheckNode(rootPageNum, 0, nullptr, nullptr, leaves, seen, leafDepth);
+    if(!error.empty()) return error;
+
+    uint32_t pageNum = leaves[0];
+    for(uint32_t leaf : leaves){
+        if(pageNum != leaf) return "leaf chain reaches page " + to_string(pageNum) + " instead of " + to_string(leaf);
+        pageNum = ((LeafNode<T>*)pager->GetPage(pageNum, 0))->nextLeaf;
+    }
+    if(pageNum != 0) return "leaf chain goes on past the last leaf, to page " + to_string(pageNum);
+
+    pageNum = ((NodeHeader*)pager->GetPage(rootPageNum, 0))->nextFree;
+    while(pageNum != 0){
+        if(pageNum >= seen.size()) return "free page " + to_string(pageNum) + " is past the end of the file";
+        if(seen[pageNum]) return "free page " + to_string(pageNum) + " is in the tree or listed twice";
+        seen[pageNum] = 1;
 
-        T key = node->cells[i].key;
-        if(L<=key && key<=R) outRowIds.push_back(rowId);
+        NodeHeader* freed = (NodeHeader*)pager->GetPage(pageNum, 0);
+        if(freed->numCells != 0) return "free page " + to_string(pageNum) + " has cells";
+        pageNum = freed->nextFree;
     }
+
+    for(uint32_t p = 0; p < seen.size(); p++){
+        if(!seen[p]) return "page " + to_string(p) + " is neither in the tree nor free";
+    }
+    return "";
 }
 
+// The node's cells must lie in [low, high), nullptr meaning unbounded
 template<typename T>
-uint16_t Btree<T>::LeafNodeDeleteRange(LeafNode<T>* node, T L, T R){
-
-    uint16_t deletedCount = 0;
-    for(uint16_t i = 0;i<node->header.numCells;i++){
-        uint32_t rowId = node->cells[i].rowId;
-        if(table->IsRowDeleted(rowId)) continue;
+string Btree<T>::CheckNode(uint32_t pageNum, uint32_t depth, const LeafCell<T>* low, const LeafCell<T>* high, vector<uint32_t>& leaves, vector<bool>& seen, uint32_t& leafDepth){
+    string at = "page " + to_string(pageNum) + ": ";
+    if(pageNum >= seen.size()) return at + "past the end of the file";
+    if(seen[pageNum]) return at + "reached twice";
+    seen[pageNum] = 1;
+
+    // a copy: checking the children may evict the page
+    vector<char> copy(BTREE_NODE_SIZE);
+    memcpy(copy.data(), pager->GetPage(pageNum, 0), BTREE_NODE_SIZE);
+    NodeHeader* header = (NodeHeader*)copy.data();
+    bool isLeaf = header->type == LEAF;
+    uint16_t n = header->numCells;
+
+    if(((LeafNode<T>*)copy.data())->version & NODE_LOCKED) return at + "still latched";
+    if(header->isRoot != (pageNum == rootPageNum)) return at + "wrong root flag";
+    if(n > (isLeaf ? LEAF_NODE_MAX_CELLS : INTERNAL_NODE_MAX_CELLS)) return at + "too many cells";
+    if(n == 0 && (!header->isRoot || !isLeaf)) return at + "empty";
+
+    const T* keys = isLeaf ? ((LeafNode<T>*)copy.data())->keys : ((InternalNode<T>*)copy.data())->keys;
+    const uint32_t* rowIds = isLeaf ? ((LeafNode<T>*)copy.data())->rowIds : ((InternalNode<T>*)copy.data())->rowIds;
+    CellLess<T> less;
+    for(uint16_t i = 0; i < n; i++){
+        LeafCell<T> cell = {keys[i], rowIds[i]};
+        if(i > 0 && !less({keys[i-1], rowIds[i-1]}, cell)) return at + "cells out of order at " + to_string(i);
+        if((low && less(cell, *low)) || (high && !less(cell, *high))) return at + "cell " + to_string(i) + " outside its parent's separators";
+    }
 
-        T key = node->cells[i].key;
-        if(L<=key && key<=R){
-            table->MarkRowDeleted(rowId);
-            deletedCount++;
-            continue;
-        }
+    if(isLeaf){
+        if(leafDepth == UINT32_MAX) leafDepth = depth;
+        if(depth != leafDepth) return at + "leaf at depth " + to_string(depth) + ", others at " + to_string(leafDepth);
+        leaves.push_back(pageNum);
+        return "";
     }
-    
 
-    return deletedCount;
+    InternalNode<T>* node = (InternalNode<T>*)copy.data();
+    for(uint16_t i = 0; i <= n; i++){
+        LeafCell<T> below = {i > 0 ? keys[i-1] : T(), i > 0 ? rowIds[i-1] : 0};
+        LeafCell<T> above = {i < n ? keys[i] : T(), i < n ? rowIds[i] : 0};
+        string error = CheckNode(ChildAt(node, i), depth + 1, i > 0 ? &below : low, i < n ? &above : high, leaves, seen, leafDepth);
+        if(!error.empty()) return error;
+    }
+    return "";
 }
-
@@ -3,37 +3,66 @@ import struct
 
 # CONFIGURATION (Must match your C++ Btree.h)
 PAGE_SIZE = 4096
-# Header: Type(1), IsRoot(1), NumCells(2), Parent(4)
-HEADER_FMT = "BBHi" 
+# Header: Type(1), IsRoot(1), NumCells(2), NextFree(4)
+# Nodes have no parent pointers. The root's NextFree holds the head of the free-page list,
+# a free page's NextFree the next free page, other nodes leave it unused
+HEADER_FMT = "BBHI" 
 HEADER_SIZE = 8
 
-# Leaf Body: NextLeaf(4) + Cells...
-LEAF_NEXT_POINTER_SIZE = 4
-
-# Cell Sizes
-LEAF_CELL_FMT = "ii"  # int32 key, int32 rowId
-LEAF_CELL_SIZE = 8
-
-INTERNAL_CELL_FMT = "iii" # int32 key, int32 rowId, uint32 childPage
-INTERNAL_CELL_SIZE = 12
+# Both node types: Header(8) + NextLeaf or RightChild(4) + Reserved(4), then one array per field:
+# Leaf:     keys[LEAF_MAX_CELLS] (int32), rowIds[LEAF_MAX_CELLS] (uint32)
+# Internal: keys[INTERNAL_MAX_CELLS] (int32), rowIds[...] (uint32), childPages[...] (uint32)
+# char(N) indexes store zero-padded keys of KEY_SIZE bytes instead, N rounded up to a FixedKey width
+ARRAYS_OFFSET = 16
+KEY_SIZE = 4
+FIXED_KEY_SIZES = [8, 16, 32, 64, 128, 256]
+LEAF_MAX_CELLS = (PAGE_SIZE - ARRAYS_OFFSET) // (KEY_SIZE + 4)
+INTERNAL_MAX_CELLS = (PAGE_SIZE - ARRAYS_OFFSET) // (KEY_SIZE + 8)
+
+def set_char_key(column_size):
+    global KEY_SIZE, LEAF_MAX_CELLS, INTERNAL_MAX_CELLS
+    KEY_SIZE = next(k for k in FIXED_KEY_SIZES if column_size <= k or k == FIXED_KEY_SIZES[-1])
+    LEAF_MAX_CELLS = (PAGE_SIZE - ARRAYS_OFFSET) // (KEY_SIZE + 4)
+    INTERNAL_MAX_CELLS = (PAGE_SIZE - ARRAYS_OFFSET) // (KEY_SIZE + 8)
 
 NODE_INTERNAL = 0
 NODE_LEAF = 1
 
+def read_array(data, index, max_cells, n, fmt):
+    # keys come first, the uint32 arrays after them
+    start = ARRAYS_OFFSET + (max_cells * KEY_SIZE + (index - 1) * max_cells * 4 if index > 0 else 0)
+    if fmt == "s":
+        return [data[start + i * KEY_SIZE : start + (i + 1) * KEY_SIZE].rstrip(b"\0") for i in range(n)]
+    return list(struct.unpack(f"<{n}{fmt}", data[start : start + n * 4]))
+
+def key_fmt():
+    return "i" if KEY_SIZE == 4 else "s"
+
+def leaf_cells(node):
+    n = node['num_cells']
+    return list(zip(read_array(node['data'], 0, LEAF_MAX_CELLS, n, key_fmt()),
+                    read_array(node['data'], 1, LEAF_MAX_CELLS, n, "I")))
+
+def internal_cells(node):
+    n = node['num_cells']
+    return list(zip(read_array(node['data'], 0, INTERNAL_MAX_CELLS, n, key_fmt()),
+                    read_array(node['data'], 1, INTERNAL_MAX_CELLS, n, "I"),
+                    read_array(node['data'], 2, INTERNAL_MAX_CELLS, n, "I")))
+
 def read_page(f, page_num):
     f.seek(page_num * PAGE_SIZE)
     data = f.read(PAGE_SIZE)
     if not data: return None
     
     header_raw = data[:HEADER_SIZE]
-    node_type, is_root, num_cells, parent = struct.unpack(HEADER_FMT, header_raw)
+    node_type, is_root, num_cells, next_free = struct.unpack(HEADER_FMT, header_raw)
     
     return {
         "page": page_num,
         "type": "LEAF" if node_type == NODE_LEAF else "INTERNAL",
         "is_root": is_root,
         "num_cells": num_cells,
-        "parent": parent,
+        "next_free": next_free,
         "data": data
     }
 
@@ -45,11 +74,22 @@ def verify_tree(filename):
             return
 
         print(f"ROOT: {root['page']} (Type: {root['type']})")
+
+        # Pages freed by merges, reused by later splits
+        free_pages = set()
+        curr = root['next_free']
+        while curr != 0:
+            if curr in free_pages:
+                print(f"  >>> CRITICAL ERROR: Cycle in the free-page list at Page {curr}")
+                break
+            free_pages.add(curr)
+            curr = read_page(f, curr)['next_free']
+        print(f"Free pages: {sorted(free_pages)}")
         
         queue = [0]
         visited = set()
         
-        # Track lineage to verify parents
+        # Every page must be reachable from exactly one parent
         child_to_parent_map = {}
         
         # Track all leaves to verify linked list later
@@ -61,22 +101,16 @@ def verify_tree(filename):
                 print(f"ERROR: Cycle detected at Page {curr_page_num}")
                 continue
             visited.add(curr_page_num)
+            if curr_page_num in free_pages:
+                print(f"  >>> CRITICAL ERROR: Page {curr_page_num} is in the tree and on the free-page list")
 
             node = read_page(f, curr_page_num)
             
             # 1. Print Node Info
-            print(f"\n[Page {curr_page_num}] Type: {node['type']}, Parent: {node['parent']}, Cells: {node['num_cells']}")
+            print(f"\n[Page {curr_page_num}] Type: {node['type']}, Parent: {child_to_parent_map.get(curr_page_num, '-')}, Cells: {node['num_cells']}")
 
-            # 2. Verify Parent Pointer
-            if curr_page_num != 0:
-                expected_parent = child_to_parent_map.get(curr_page_num, -1)
-                if node['parent'] != expected_parent:
-                    print(f"  >>> CRITICAL ERROR: Page {curr_page_num} thinks parent is {node['parent']}, but it is actually child of {expected_parent}")
-
-            # 3. Parse Body based on Type
+            # 2. Parse Body based on Type
             if node['type'] == "INTERNAL":
-                # Internal Node Layout: [Header] [RightChildPtr] [Cell 0] [Cell 1]...
-                
                 # Right Child Pointer is immediately after header (Offset 8)
                 right_child = struct.unpack("I", node['data'][HEADER_SIZE : HEADER_SIZE+4])[0]
                 
@@ -89,11 +123,7 @@ def verify_tree(filename):
                 child_to_parent_map[right_child] = curr_page_num
                 queue.append(right_child)
 
-                # Cells start after Header + RightChildPtr = 12
-                cell_offset = HEADER_SIZE + 4
-                for i in range(node['num_cells']):
-                    raw_cell = node['data'][cell_offset : cell_offset + INTERNAL_CELL_SIZE]
-                    key, row_id, child_page = struct.unpack(INTERNAL_CELL_FMT, raw_cell)
+                for key, row_id, child_page in internal_cells(node):
                     
                     print(f"  -> Key: {key}, Child: {child_page}")
                     
@@ -102,28 +132,18 @@ def verify_tree(filename):
                     
                     child_to_parent_map[child_page] = curr_page_num
                     queue.append(child_page)
-                    cell_offset += INTERNAL_CELL_SIZE
 
             elif node['type'] == "LEAF":
                 leaf_pages.append(curr_page_num)
                 
-                # Leaf Node Layout: [Header] [NextLeafPtr] [Cell 0] [Cell 1]...
-                
                 # Next Leaf Pointer is immediately after header (Offset 8)
                 next_leaf = struct.unpack("I", node['data'][HEADER_SIZE : HEADER_SIZE+4])[0]
                 print(f"  -> Next Leaf: {next_leaf}")
 
-                # Cells start after Header + NextLeafPtr = 12
-                offset = HEADER_SIZE + LEAF_NEXT_POINTER_SIZE
-                keys = []
-                for i in range(node['num_cells']):
-                    raw_cell = node['data'][offset : offset + LEAF_CELL_SIZE]
-                    key, row_id = struct.unpack(LEAF_CELL_FMT, raw_cell)
-                    keys.append(key)
-                    offset += LEAF_CELL_SIZE
+                keys = [key for key, _ in leaf_cells(node)]
                 print(f"  Keys: {keys}")
 
-        # 4. Verify Linked List (Scan Logic)
+        # 3. Verify Linked List (Scan Logic)
         print("\n--- Verifying Linked List Structure ---")
         if not leaf_pages: return
 
@@ -138,16 +158,9 @@ def verify_tree(filename):
             if n['type'] == "LEAF":
                 left_most_leaf = curr
                 break
-            # Go to the first child (Cell 0's child)
-            # Internal Layout: Header(8) + RightChild(4) + Cell0(Key, Row, Child)
-            # Cell 0 Child is at offset 12 + 8 = 20 bytes? No.
-            # Internal Cell: Key(4), Row(4), Child(4). Child is at end of cell.
-            # So Header(8) + RightChild(4) + Cell0[Key(4), Row(4), Child(4)]
-            # Child is at 8+4+4+4 = 20? No.
-            # Offset = 12. Cell0 starts. Child is at 12 + 8 = 20.
+            # Go to the first child (childPages[0], or the right child if there are no cells)
             if n['num_cells'] > 0:
-                first_cell_child = struct.unpack("I", n['data'][20:24])[0]
-                curr = first_cell_child
+                curr = internal_cells(n)[0][2]
             else:
                 # If internal node has no cells, follow right child
                 right_child = struct.unpack("I", n['data'][8:12])[0]
@@ -157,34 +170,34 @@ def verify_tree(filename):
         
         visited_leaves = 0
         curr = left_most_leaf
-        last_key = -1
+        last_key = -2**31 if KEY_SIZE == 4 else b""
         
-        while curr != 0:
+        while True:
             visited_leaves += 1
             n = read_page(f, curr)
             
             # Verify Sorting across pages
-            offset = HEADER_SIZE + LEAF_NEXT_POINTER_SIZE
-            for i in range(n['num_cells']):
-                raw_cell = n['data'][offset : offset + LEAF_CELL_SIZE]
-                key, _ = struct.unpack(LEAF_CELL_FMT, raw_cell)
+            for key, _ in leaf_cells(n):
                 if key < last_key:
                     print(f"  >>> CRITICAL ERROR: Sort Order Violated! Page {curr} has key {key} which is < previous key {last_key}")
                 last_key = key
-                offset += LEAF_CELL_SIZE
                 
             next_leaf = struct.unpack("I", n['data'][HEADER_SIZE : HEADER_SIZE+4])[0]
             print(f"  Page {curr} -> Page {next_leaf}")
             curr = next_leaf
+            if curr == 0: break # page 0 is the root, never a later leaf
             
-            if visited_leaves > 1000:
+            if visited_leaves > len(visited):
                 print("  >>> Error: Infinite Loop in Linked List!")
                 break
 
         print(f"Walked {visited_leaves} leaf pages.")
+        if visited_leaves != len(leaf_pages):
+            print(f"  >>> CRITICAL ERROR: The tree has {len(leaf_pages)} leaves but the chain links {visited_leaves}")
 
 if __name__ == "__main__":
     if len(sys.argv) < 2:
-        print("Usage: python check_tree.py <filename>")
+        print("Usage: python check_tree.py <filename> [char column size, for char indexes]")
     else:
+        if len(sys.argv) > 2: set_char_key(int(sys.argv[2]))
         verify_tree(sys.argv[1])
\ No newline at end of file
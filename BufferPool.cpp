@@ -0,0 +1,395 @@
+// BufferPool.cpp
+
+#include "BufferPool.h"
+#include "Pager.h"
+#include "Wal.h"
+
+#include <iostream>
+#include <cstring> // for memset
+#include <algorithm> // for std::min
+#include <cstdio>    // for remove
+
+#ifdef _WIN32
+    #include <windows.h> // VirtualAlloc
+#else
+    #include <sys/mman.h>
+#endif
+
+
+
+BufferPool* BufferPool::instance = nullptr;
+
+BufferPool& BufferPool::GetInstance(){
+    if(!instance) instance = new BufferPool(BufferPoolConfig());
+    return *instance;
+}
+
+void BufferPool::InitInstance(const BufferPoolConfig& config){
+    if(!instance) instance = new BufferPool(config);
+}
+
+BufferPool::BufferPool(const BufferPoolConfig& config)
+    : MAX_PAGES(config.maxPages), framesAllocated(0), ghostSeq(0), mmapFiles(config.mmapFiles), directIo(config.directIo)
+{
+    if(MAX_PAGES < MIN_CACHE_LIMIT || MAX_PAGES > MAX_CACHE_LIMIT){
+        cerr << "Warning: cache size must be between " << MIN_CACHE_LIMIT << " and " << MAX_CACHE_LIMIT << " pages, using " << DEFAULT_CACHE_LIMIT << endl;
+        MAX_PAGES = DEFAULT_CACHE_LIMIT;
+    }
+
+    A1IN_LIMIT = MAX_PAGES / 4;
+    A1OUT_LIMIT = MAX_PAGES / 2;
+    SCAN_RING_LIMIT = min(SCAN_RING_PAGES, MAX_PAGES / 4);
+
+    io = IoBackend::Create(config.ioBackend);
+
+#ifdef _WIN32
+    if(mmapFiles) cerr << "Warning: --mmap is not supported on Windows, reading through the pool" << endl;
+    mmapFiles = false;
+#endif
+    if(mmapFiles && directIo){
+        cerr << "Warning: --mmap reads through the OS page cache, ignoring it with --direct-io" << endl;
+        mmapFiles = false;
+    }
+
+    pageTable.Init(MAX_PAGES);
+    arenaSize = (uint64_t)MAX_PAGES * PAGE_SIZE;
+    arena = AllocateArena(config.hugePages);
+
+    buffers.resize(MAX_PAGES);
+    for(uint32_t i = 0; i < MAX_PAGES; i++){
+        PageBuffer& b = buffers[i];
+        b.data = arena + (uint64_t)i * PAGE_SIZE;
+        b.pinCount = 0;
+        b.flags = 0;
+        b.queue = Q_NONE;
+        b.prev = b.next = NO_FRAME;
+    }
+}
+
+BufferPool::~BufferPool(){
+#ifdef _WIN32
+    VirtualFree(arena, 0, MEM_RELEASE);
+#else
+    munmap(arena, arenaSize);
+#endif
+}
+
+char* BufferPool::AllocateArena(HugePages hugePages){
+#ifdef _WIN32
+    if(hugePages != HugePages::OFF) cerr << "Warning: huge pages need Linux, using normal pages" << endl;
+    void* p = VirtualAlloc(nullptr, arenaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(p == nullptr){
+        cerr << "Error: Unable to allocate " << arenaSize << " bytes for the buffer pool" << endl;
+        exit(1);
+    }
+    return (char*)p;
+#else
+    void* p = MAP_FAILED;
+
+    if(hugePages == HugePages::EXPLICIT){
+    #ifdef MAP_HUGETLB
+        // needs pages reserved in /proc/sys/vm/nr_hugepages, all taken up front
+        uint64_t size = (arenaSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED) arenaSize = size;
+    #endif
+        if(p == MAP_FAILED) cerr << "Warning: Unable to reserve huge pages for the buffer pool, using normal pages" << endl;
+    }
+
+    if(p == MAP_FAILED){
+        p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(p == MAP_FAILED){
+            cerr << "Error: Unable to allocate " << arenaSize << " bytes for the buffer pool" << endl;
+            exit(1);
+        }
+    #ifdef MADV_HUGEPAGE
+        if(hugePages == HugePages::TRANSPARENT) madvise(p, arenaSize, MADV_HUGEPAGE);
+    #else
+        if(hugePages == HugePages::TRANSPARENT) cerr << "Warning: transparent huge pages need Linux, using normal pages" << endl;
+    #endif
+    }
+
+    return (char*)p;
+#endif
+}
+
+uint16_t BufferPool::RegisterFile(Pager* pager){
+    for(uint16_t i = 0; i < files.size(); i++){
+        if(files[i] == nullptr){
+            files[i] = pager;
+            return i;
+        }
+    }
+    files.push_back(pager);
+    return files.size() - 1;
+}
+
+void BufferPool::UnregisterFile(uint16_t fileId){
+    // Unsaved pages of a closed file are dropped, same as exiting without .commit
+    for(uint32_t i = 0; i < framesAllocated; i++){
+        PageBuffer& b = buffers[i];
+        if((b.flags & VALID) && b.fileId == fileId){
+            pageTable.Erase(FrameKey(fileId, b.pageNum));
+            Unlink(i);
+            b.pinCount = 0;
+            b.flags = 0;
+            freeFrames.push_back(i);
+        }
+    }
+    files[fileId] = nullptr;
+}
+
+FrameList& BufferPool::Queue(uint8_t queue){
+    return queue == Q_AM ? am : a1in;
+}
+
+void BufferPool::PushFront(FrameList& list, uint32_t id){
+    PageBuffer& b = buffers[id];
+    b.queue = &list == &am ? Q_AM : Q_A1IN;
+    b.prev = NO_FRAME;
+    b.next = list.head;
+    if(list.head != NO_FRAME) buffers[list.head].prev = id;
+    else list.tail = id;
+    list.head = id;
+    list.size++;
+}
+
+void BufferPool::PushBack(FrameList& list, uint32_t id){
+    PageBuffer& b = buffers[id];
+    b.queue = &list == &am ? Q_AM : Q_A1IN;
+    b.next = NO_FRAME;
+    b.prev = list.tail;
+    if(list.tail != NO_FRAME) buffers[list.tail].next = id;
+    else list.head = id;
+    list.tail = id;
+    list.size++;
+}
+
+void BufferPool::Unlink(uint32_t id){
+    PageBuffer& b = buffers[id];
+    if(b.queue == Q_A1IN || b.queue == Q_AM){
+        FrameList& list = Queue(b.queue);
+        if(b.prev != NO_FRAME) buffers[b.prev].next = b.next;
+        else list.head = b.next;
+        if(b.next != NO_FRAME) buffers[b.next].prev = b.prev;
+        else list.tail = b.prev;
+        list.size--;
+    }
+    b.queue = Q_NONE;
+    b.prev = b.next = NO_FRAME;
+}
+
+void BufferPool::EvictFrame(uint32_t id){
+    PageBuffer& b = buffers[id];
+    pageTable.Erase(FrameKey(b.fileId, b.pageNum));
+
+    Pager* owner = files[b.fileId];
+    owner->stats.evictions++;
+
+    // uncommitted changes go to the log, never straight into the file
+    if(b.flags & DIRTY){
+        owner->stats.dirtyEvictions++;
+        owner->LogPage(b.pageNum, b.data);
+    }
+    b.flags = 0;
+}
+
+uint32_t BufferPool::AllocateFrame(){
+    if(!freeFrames.empty()){
+        uint32_t id = freeFrames.back();
+        freeFrames.pop_back();
+        return id;
+    }
+
+    if(framesAllocated < MAX_PAGES) return framesAllocated++;
+
+    // drain A1in while it holds more than its share, so one-time pages go first
+    bool fromA1in = a1in.size > A1IN_LIMIT;
+    for(FrameList* list : { fromA1in ? &a1in : &am, fromA1in ? &am : &a1in }){
+        for(uint32_t id = list->tail; id != NO_FRAME; id = buffers[id].prev){
+            PageBuffer& b = buffers[id];
+            if(b.pinCount > 0) continue;
+
+            if(list == &a1in){
+                // remember it: a second reference soon after makes it hot
+                uint64_t key = FrameKey(b.fileId, b.pageNum);
+                ghosts[key] = ++ghostSeq;
+                ghostQueue.push_back({key, ghostSeq});
+                while(ghostQueue.size() > A1OUT_LIMIT){
+                    auto [oldKey, seq] = ghostQueue.front();
+                    ghostQueue.pop_front();
+                    auto it = ghosts.find(oldKey);
+                    if(it != ghosts.end() && it->second == seq) ghosts.erase(it);
+                }
+            }
+
+            Unlink(id);
+            EvictFrame(id);
+            return id;
+        }
+    }
+
+    cerr << "Error: Every page in the buffer pool is pinned." << endl;
+    exit(1);
+}
+
+uint32_t BufferPool::ScanFrame(Pager* pager){
+    vector<uint32_t>& ring = pager->scanRing;
+
+    if(ring.size() >= SCAN_RING_LIMIT){
+        uint32_t id = ring[pager->scanHand];
+        pager->scanHand = (pager->scanHand + 1) % ring.size();
+        if(buffers[id].pinCount == 0){
+            EvictFrame(id);
+            return id;
+        }
+        return AllocateFrame(); // still in use, this page takes the normal path
+    }
+
+    uint32_t id = AllocateFrame();
+    buffers[id].queue = Q_RING;
+    ring.push_back(id);
+    return id;
+}
+
+void BufferPool::BeginScan(Pager* pager){
+    pager->scanDepth++;
+}
+
+void BufferPool::EndScan(Pager* pager){
+    if(--pager->scanDepth > 0) return;
+
+    // what the scan left behind is the first thing to go
+    for(uint32_t id : pager->scanRing){
+        if(buffers[id].queue != Q_RING) continue;
+        buffers[id].queue = Q_NONE;
+        if(buffers[id].flags & VALID) PushBack(a1in, id);
+        else freeFrames.push_back(id);
+    }
+    pager->scanRing.clear();
+    pager->scanHand = 0;
+}
+
+void BufferPool::SetDirty(PageBuffer& b){
+    if(b.flags & DIRTY) return;
+    b.flags |= DIRTY;
+    files[b.fileId]->dirtyPages.push_back(b.pageNum);
+}
+
+void BufferPool::MarkDirty(uint16_t fileId, uint32_t pageNum){
+    uint32_t id = pageTable.Find(FrameKey(fileId, pageNum));
+    if(id != NO_FRAME) SetDirty(buffers[id]);
+}
+
+uint32_t BufferPool::FetchFrame(uint16_t fileId, uint32_t pageNum, bool markDirty){
+    uint64_t key = FrameKey(fileId, pageNum);
+
+    Pager* pager = files[fileId];
+
+    uint32_t id = pageTable.Find(key);
+    if(id != NO_FRAME){
+        PageBuffer &b = buffers[id];
+        if(b.queue == Q_AM && pager->scanDepth == 0){
+            Unlink(id);
+            PushFront(am, id);
+        }
+        if(markDirty) SetDirty(b);
+        pager->stats.hits++;
+        return id;
+    }
+
+    pager->stats.misses++;
+
+    uint32_t victimId = NewFrame(fileId, pageNum);
+    PageBuffer &b = buffers[victimId];
+    if(files[fileId]->LoadPage(pageNum, b.data) || markDirty) SetDirty(b);
+
+    return victimId;
+}
+
+uint32_t BufferPool::NewFrame(uint16_t fileId, uint32_t pageNum){
+    uint64_t key = FrameKey(fileId, pageNum);
+    Pager* pager = files[fileId];
+
+    uint32_t victimId = pager->scanDepth > 0 ? ScanFrame(pager) : AllocateFrame();
+
+    PageBuffer &b = buffers[victimId];
+
+    b.fileId = fileId;
+    b.pageNum = pageNum;
+    b.flags = VALID;
+
+    if(b.queue == Q_NONE){
+        auto ghost = ghosts.find(key);
+        if(ghost != ghosts.end()){
+            ghosts.erase(ghost);
+            PushFront(am, victimId);
+        }
+        else PushFront(a1in, victimId);
+    }
+
+    pageTable.Insert(key, victimId);
+    return victimId;
+}
+
+void* BufferPool::GetPage(uint16_t fileId, uint32_t pageNum, bool markDirty){
+    return buffers[FetchFrame(fileId, pageNum, markDirty)].data;
+}
+
+void* BufferPool::PinPage(uint16_t fileId, uint32_t pageNum, bool markDirty){
+    PageBuffer& b = buffers[FetchFrame(fileId, pageNum, markDirty)];
+    b.pinCount++;
+    return b.data;
+}
+
+void BufferPool::UnpinPage(uint16_t fileId, uint32_t pageNum){
+    uint32_t id = pageTable.Find(FrameKey(fileId, pageNum));
+    if(id != NO_FRAME && buffers[id].pinCount > 0) buffers[id].pinCount--;
+}
+
+void BufferPool::OpenWal(const string& fileName){
+    if(!wal) wal = make_unique<Wal>(fileName, io.get());
+}
+
+void BufferPool::Commit(){
+    for(Pager* pager : files){
+        if(pager) pager->LogDirtyPages();
+    }
+
+    wal->Commit();
+
+    if(wal->Size() >= WAL_CHECKPOINT_SIZE) Checkpoint();
+}
+
+void BufferPool::Checkpoint(){
+    // only valid right after a commit: every record in the log is committed
+    if(!wal || wal->hasUncommitted) return;
+
+    for(Pager* pager : files){
+        if(pager) pager->FlushAll();
+    }
+
+    wal->Reset();
+    wal->stats.checkpoints++;
+}
+
+void BufferPool::RemoveFile(const string& fileName){
+    if(wal) wal->AppendDrop(fileName);
+    remove(fileName.c_str());
+}
+
+PagerStats BufferPool::TotalStats(){
+    PagerStats total = closedStats;
+    for(Pager* pager : files){
+        if(pager) total += pager->stats;
+    }
+    return total;
+}
+
+void BufferPool::ResetStats(){
+    closedStats = PagerStats();
+    for(Pager* pager : files){
+        if(pager) pager->stats = PagerStats();
+    }
+    if(wal) wal->stats = WalStats();
+}
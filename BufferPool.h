@@ -0,0 +1,161 @@
+// BufferPool.h
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "IoBackend.h"
+#include "PageTable.h"
+#include "Stats.h"
+
+using namespace std;
+
+class Pager;
+class Wal;
+
+
+#define PAGE_SIZE 4096
+const uint32_t DEFAULT_CACHE_LIMIT = 50000; //50k page ~200MB, shared by every file
+const uint32_t MIN_CACHE_LIMIT = 16; // enough for every page a B+ tree split keeps pinned
+const uint32_t MAX_CACHE_LIMIT = 1u << 28; // 1TB of frames
+const uint32_t SCAN_RING_PAGES = 32; // frames a full scan may cycle through, at most a quarter of the pool
+
+enum PageBufferFlags : uint8_t {
+    VALID = 1,
+    DIRTY = 2
+};
+
+// Which replacement queue a frame is on
+enum FrameQueue : uint8_t {
+    Q_NONE = 0, // free, or being handed out
+    Q_A1IN, // referenced once: FIFO, evicted first
+    Q_AM, // referenced again after leaving A1in: LRU
+    Q_RING // owned by a running scan
+};
+
+struct PageBuffer{
+    void* data;
+    uint32_t pageNum;
+    uint16_t fileId;
+    uint16_t pinCount; // pinned frames are never evicted
+    uint8_t flags;
+    uint8_t queue;
+    uint32_t prev; // neighbours on the queue, towards the head and the tail
+    uint32_t next;
+};
+
+// Intrusive list of frames: head is the most recently inserted, tail is evicted first
+struct FrameList{
+    uint32_t head = NO_FRAME;
+    uint32_t tail = NO_FRAME;
+    uint32_t size = 0;
+};
+
+enum class HugePages { OFF, TRANSPARENT, EXPLICIT };
+
+const uint64_t HUGE_PAGE_SIZE = 2 << 20; // explicit huge page arenas are rounded up to this
+
+struct BufferPoolConfig{
+    uint32_t maxPages = DEFAULT_CACHE_LIMIT;
+    IoBackendType ioBackend = IoBackendType::POSIX;
+    bool mmapFiles = false; // serve clean pages straight from a read-only mapping of each file
+    HugePages hugePages = HugePages::OFF; // back the frame arena with huge pages (Linux)
+    bool directIo = false; // open table and index files with O_DIRECT
+};
+
+// One process-wide cache for every heap file and index file.
+// Frames are keyed by (fileId, pageNum), so all files compete for the same budget.
+// Replacement is 2Q: pages seen once wait in a short FIFO (A1in) and only pages referenced
+// again after leaving it (remembered by key in A1out) reach the LRU main queue (Am).
+// Full scans additionally recycle a small ring of their own frames, see ScanGuard.
+// Frames live in one page-aligned arena reserved up front; the OS only backs what gets touched.
+// Dirty pages only reach their files through the WAL: evictions and commits append
+// page images to the log, and checkpoints copy logged pages into place.
+class BufferPool {
+public:
+    static BufferPool& GetInstance();
+    static void InitInstance(const BufferPoolConfig& config);
+
+    ~BufferPool();
+
+    // File registry
+    uint16_t RegisterFile(Pager* pager);
+    void UnregisterFile(uint16_t fileId);
+
+    // Management
+    void* GetPage(uint16_t fileId, uint32_t pageNum, bool markDirty);
+    void* PinPage(uint16_t fileId, uint32_t pageNum, bool markDirty);
+    void UnpinPage(uint16_t fileId, uint32_t pageNum);
+    void MarkDirty(uint16_t fileId, uint32_t pageNum);
+    void SetDirty(PageBuffer& b); // records the page in its pager's dirty list on the first change
+
+    // Replacement
+    uint32_t FetchFrame(uint16_t fileId, uint32_t pageNum, bool markDirty); // shared by GetPage and PinPage
+    uint32_t NewFrame(uint16_t fileId, uint32_t pageNum); // a frame registered for the page, its data not loaded yet
+    uint32_t AllocateFrame(); // a free frame, or the 2Q victim
+    uint32_t ScanFrame(Pager* pager); // a frame from the pager's scan ring
+    void EvictFrame(uint32_t id); // drops the page the frame holds, logging it if dirty
+    void BeginScan(Pager* pager);
+    void EndScan(Pager* pager);
+
+    char* AllocateArena(HugePages hugePages);
+
+    void PushFront(FrameList& list, uint32_t id);
+    void PushBack(FrameList& list, uint32_t id);
+    void Unlink(uint32_t id);
+    FrameList& Queue(uint8_t queue);
+    // Durability
+    void OpenWal(const string& fileName); // replays committed records left by a crash
+    void Commit();
+    void Checkpoint();
+    void RemoveFile(const string& fileName); // deletes a file no pager has open, recovery won't bring its pages back
+
+    // Statistics
+    PagerStats TotalStats(); // every file, open or closed
+    void ResetStats();
+
+    static uint64_t FrameKey(uint16_t fileId, uint32_t pageNum){
+        return ((uint64_t)fileId << 32) | pageNum;
+    }
+
+public:
+    uint32_t MAX_PAGES;
+    vector<PageBuffer> buffers;
+    char* arena; // every frame, contiguous and page aligned: frame i is at arena + i * PAGE_SIZE
+    uint64_t arenaSize;
+    PageTable pageTable; // maps (fileId, pageNum) -> index in buffers
+    vector<uint32_t> freeFrames; // frames released by closed files
+    uint32_t framesAllocated; // frames handed out so far, up to MAX_PAGES
+
+    FrameList a1in;
+    FrameList am;
+    uint32_t A1IN_LIMIT; // a quarter of the pool
+    uint32_t A1OUT_LIMIT; // ghost keys remembered, half the pool
+    uint32_t SCAN_RING_LIMIT;
+    unordered_map<uint64_t, uint64_t> ghosts; // pages recently evicted from A1in -> their entry in ghostQueue
+    deque<pair<uint64_t, uint64_t>> ghostQueue; // (key, sequence), oldest first
+    uint64_t ghostSeq;
+
+    vector<Pager*> files; // indexed by fileId, nullptr for free slots
+    unique_ptr<IoBackend> io;
+    unique_ptr<Wal> wal;
+    PagerStats closedStats; // counters of files closed so far
+
+    bool mmapFiles; // read by each Pager when it opens its file
+    bool directIo;
+
+    // Pagers hold it around every call into the pool, so pages can be fetched and
+    // pinned from several threads. Commit and Checkpoint do not take it: they expect
+    // no other thread to be using the pool.
+    mutex mtx;
+
+private:
+    BufferPool(const BufferPoolConfig& config);
+    static BufferPool* instance; // never destroyed, so pagers can still unregister during exit
+};
@@ -4,13 +4,19 @@
 #include "Database.h"
 #include "Schema.h"      // Need full definition of Row/Table to print
 #include "CommandParser.h"
+#include "BufferPool.h"
+#include "Pager.h"
+#include "Wal.h"
 
 #include <iostream>
 #include <iomanip> // setw
 #include <sstream> // stringstream
+#include <cstring> // memcpy
 
-void PrintTable(const vector<Row*>& rows, Table* t) {
-    if (rows.empty()) {
+// Prints rows as the cursor yields them, the result is never held in memory.
+void PrintTable(RowCursor* cursor, Table* t) {
+    Row row;
+    if (!cursor->Next(row)) {
         cout << "Empty set." << endl;
         return;
     }
@@ -34,25 +40,126 @@ void PrintTable(const vector<Row*>& rows, Table* t) {
     cout << endl;
 
     // 3. Print Rows
-    for (Row* r : rows) {
+    uint64_t count = 0;
+    do {
         cout << "|";
         for (uint32_t i = 0; i < t->schema.size(); i++) {
             Column* c = t->schema[i];
             if (c->type == INT) {
-                cout << " " << left << setw(widths[i]) << *(int*)r->value[c->columnName] << " |";
+                cout << " " << left << setw(widths[i]) << *(int*)row.Value(c) << " |";
             } else {
-                cout << " " << left << setw(widths[i]) << (char*)r->value[c->columnName] << " |";
+                cout << " " << left << setw(widths[i]) << (char*)row.Value(c) << " |";
             }
         }
-        cout << endl;
-        delete r; // Clean up row after printing
-    }
+        cout << "\n";
+        count++;
+    } while (cursor->Next(row));
 
     // 4. Print Footer
     cout << "+";
     for (int w : widths) cout << string(w + 2, '-') << "+";
     cout << endl;
-    cout << rows.size() << " rows in set." << endl;
+    cout << count << " rows in set." << endl;
+}
+
+static void PrintStatsJson(const PagerStats& s){
+    cout << "{\"hits\":" << s.hits << ",\"misses\":" << s.misses
+         << ",\"evictions\":" << s.evictions << ",\"dirtyEvictions\":" << s.dirtyEvictions
+         << ",\"pagesRead\":" << s.pagesRead << ",\"pagesWritten\":" << s.pagesWritten
+         << ",\"bytesSynced\":" << s.bytesSynced << ",\"ioNanos\":" << s.ioNanos << "}";
+}
+
+static void PrintStatsRow(const string& name, const PagerStats& s){
+    uint64_t lookups = s.hits + s.misses;
+    double hitRate = lookups ? 100.0 * s.hits / lookups : 0;
+
+    cout << "| " << left << setw(28) << name
+         << "| " << right << setw(10) << s.hits
+         << " | " << setw(10) << s.misses
+         << " | " << setw(6) << fixed << setprecision(1) << hitRate
+         << " | " << setw(9) << s.evictions
+         << " | " << setw(9) << s.dirtyEvictions
+         << " | " << setw(9) << s.pagesRead
+         << " | " << setw(9) << s.pagesWritten
+         << " | " << setw(9) << s.bytesSynced / 1024
+         << " | " << setw(9) << setprecision(3) << s.ioNanos / 1e6 << " |" << left << endl;
+}
+
+void PrintStats(bool json){
+    BufferPool& pool = BufferPool::GetInstance();
+    PagerStats total = pool.TotalStats();
+    WalStats walStats = pool.wal ? pool.wal->stats : WalStats();
+    uint32_t framesUsed = pool.framesAllocated - pool.freeFrames.size();
+
+    if(json){
+        cout << "{\"pool\":{\"frames\":" << pool.MAX_PAGES << ",\"framesUsed\":" << framesUsed
+             << ",\"io\":\"" << pool.io->Name() << "\"},\"files\":[";
+        bool first = true;
+        for(Pager* p : pool.files){
+            if(!p) continue;
+            if(!first) cout << ",";
+            first = false;
+            cout << "{\"file\":" << quoted(p->fileName) << ",\"stats\":";
+            PrintStatsJson(p->stats);
+            cout << "}";
+        }
+        cout << "],\"closed\":";
+        PrintStatsJson(pool.closedStats);
+        cout << ",\"total\":";
+        PrintStatsJson(total);
+        cout << ",\"wal\":{\"pagesLogged\":" << walStats.pagesLogged << ",\"commits\":" << walStats.commits
+             << ",\"bytesWritten\":" << walStats.bytesWritten << ",\"syncs\":" << walStats.syncs
+             << ",\"bytesSynced\":" << walStats.bytesSynced << ",\"checkpoints\":" << walStats.checkpoints
+             << ",\"ioNanos\":" << walStats.ioNanos << "}}" << endl;
+        return;
+    }
+
+    string border;
+    for(uint32_t width : { 29, 12, 12, 8, 11, 11, 11, 11, 11, 11 }) border.append(1, '+').append(width, '-');
+    border += "+";
+
+    cout << border << endl;
+    cout << "| " << left << setw(28) << "File"
+         << "| " << setw(11) << "Hits" << "| " << setw(11) << "Misses" << "| " << setw(7) << "Hit %"
+         << "| " << setw(10) << "Evicted" << "| " << setw(10) << "Dirty ev." << "| " << setw(10) << "Read"
+         << "| " << setw(10) << "Written" << "| " << setw(10) << "Synced KB" << "| " << setw(10) << "I/O ms" << "|" << endl;
+    cout << border << endl;
+
+    for(Pager* p : pool.files){
+        if(p) PrintStatsRow(p->fileName, p->stats);
+    }
+    PrintStatsRow("(closed files)", pool.closedStats);
+    cout << border << endl;
+    PrintStatsRow("Total", total);
+    cout << border << endl;
+
+    cout << "Pool: " << framesUsed << " / " << pool.MAX_PAGES << " frames in use, " << pool.io->Name() << " I/O" << endl;
+    cout << "WAL: " << walStats.pagesLogged << " pages logged, " << walStats.commits << " commits, "
+         << walStats.bytesWritten / 1024 << " KB written, " << walStats.syncs << " fsyncs ("
+         << walStats.bytesSynced / 1024 << " KB), " << walStats.checkpoints << " checkpoints, "
+         << fixed << setprecision(3) << walStats.ioNanos / 1e6 << " ms I/O" << endl;
+}
+
+// A WHERE bound in the column's own layout: an int, or a zero-padded char(size)
+// truncated like inserted values are. False if the column does not exist.
+static bool ParseBound(Table* t, const string& colName, const string& value, vector<char>& out){
+    auto it = t->colPtr.find(colName);
+    if(it == t->colPtr.end()){
+        cout << "Error: Column " << colName << " not found." << endl;
+        return false;
+    }
+
+    Column* c = it->second;
+    if(c->type == INT){
+        int32_t num = stoi(value);
+        out.resize(sizeof(int32_t));
+        memcpy(out.data(), &num, sizeof(int32_t));
+    }
+    else{
+        out.assign(c->size, 0);
+        memcpy(out.data(), value.data(), min((uint32_t)value.size(), c->size - 1));
+    }
+    return true;
 }
 
 void ProcessDotCommand(const string &line){
@@ -72,6 +179,26 @@ void ProcessDotCommand(const string &line){
         cout << "Changes committed to disk." << endl;
         return;
     }
+    if(cmd == ".stats"){
+        string option;
+        ss >> option;
+        if(option == "reset"){
+            BufferPool::GetInstance().ResetStats();
+            cout << "Statistics reset." << endl;
+        }
+        else PrintStats(option == "json");
+        return;
+    }
+    if(cmd == ".import"){
+        string fileName;
+        ss >> tableName >> fileName;
+        uint32_t count;
+        Result res = Database::GetInstance().Import(tableName, fileName, count);
+        if (res == Result::OK) cout << "Imported " << count << " rows." << endl;
+        else if (res == Result::TABLE_NOT_FOUND) cout << "Error: Table '" << tableName << "' not found." << endl;
+        else cout << "Error: Could not open '" << fileName << "'." << endl;
+        return;
+    }
     if(cmd == ".help"){
         cout << "Read the readme, i aint helping lol" << endl;
         return;
@@ -126,13 +253,8 @@ void ProcessDotCommand(const string &line){
         cout << string(50, '-') << endl;
 
         for(Column* c : t->schema){
-            string indexStatus = "-";
-            
-            // Check if this INT column has an active B-Tree pager
-            if(c->type == INT){
-                if(t->colIdx.count(c->columnName)) indexStatus = "YES";
-                else indexStatus = "NO";
-            }
+            // Check if this column has an active B-Tree pager
+            const char* indexStatus = t->colIdx.count(c->columnName) ? "YES" : "NO";
 
             cout << left << setw(15) << c->columnName 
                  << left << setw(10) << GetTypeName(c->type) 
@@ -166,6 +288,11 @@ void ExecuteCommand(const string &line){
         if (res == Result::OK) cout << "Query OK: Table '" << cmd.tableName << "' created." << endl;
         else cout << "Error: Could not create table." << endl;
     }
+    else if (cmd.type == "CREATE_INDEX") {
+        Result res = Database::GetInstance().CreateIndex(cmd.tableName, cmd.args[0]);
+        if (res == Result::OK) cout << "Query OK: Index on '" << cmd.tableName << "." << cmd.args[0] << "' created." << endl;
+        else if (res == Result::TABLE_NOT_FOUND) cout << "Error: Table '" << cmd.tableName << "' not found." << endl;
+    }
     else if (cmd.type == "INSERT") {
         // FIX: Fetch table FIRST to check column types
         Table* t = Database::GetInstance().GetTable(cmd.tableName);
@@ -196,18 +323,36 @@ void ExecuteCommand(const string &line){
         Table* t = Database::GetInstance().GetTable(cmd.tableName);
         if (!t) { cout << "Error: Table '" << cmd.tableName << "' not found." << endl; return; }
 
-        vector<Row*> rows;
+        RowCursor* cursor = nullptr;
         if (cmd.args.empty()) {
-            Database::GetInstance().SelectAll(t, rows);
+            cursor = Database::GetInstance().OpenSelect(t);
         } else {
             // Args are [col, min, max]
             string col = cmd.args[0];
-            int32_t l = stoi(cmd.args[1]);
-            int32_t r = stoi(cmd.args[2]);
-            Database::GetInstance().SelectWithRange(t, col, &l, &r, rows);
+            vector<char> l, r;
+            if (!ParseBound(t, col, cmd.args[1], l) || !ParseBound(t, col, cmd.args[2], r)) return;
+            cursor = Database::GetInstance().OpenSelect(t, col, l.data(), r.data());
+            if (!cursor) return;
         }
         
-        PrintTable(rows, t);
+        PrintTable(cursor, t);
+        delete cursor;
+    }
+    else if (cmd.type == "COUNT") {
+        Table* t = Database::GetInstance().GetTable(cmd.tableName);
+        if (!t) { cout << "Error: Table '" << cmd.tableName << "' not found." << endl; return; }
+
+        uint32_t count = 0;
+        if (cmd.args.empty()) {
+            count = Database::GetInstance().CountAll(t);
+        } else {
+            // Args are [col, min, max]
+            vector<char> l, r;
+            if (!ParseBound(t, cmd.args[0], cmd.args[1], l) || !ParseBound(t, cmd.args[0], cmd.args[2], r)) return;
+            count = Database::GetInstance().CountWithRange(t, cmd.args[0], l.data(), r.data());
+        }
+
+        cout << "Count: " << count << endl;
     }
     else if (cmd.type == "DELETE") {
         Table* t = Database::GetInstance().GetTable(cmd.tableName);
@@ -219,9 +364,9 @@ void ExecuteCommand(const string &line){
         } else {
             // Args are [col, min, max]
             string col = cmd.args[0];
-            int32_t l = stoi(cmd.args[1]);
-            int32_t r = stoi(cmd.args[2]);
-            deletedCount = Database::GetInstance().DeleteWithRange(t, col, &l, &r);
+            vector<char> l, r;
+            if (!ParseBound(t, col, cmd.args[1], l) || !ParseBound(t, col, cmd.args[2], r)) return;
+            deletedCount = Database::GetInstance().DeleteWithRange(t, col, l.data(), r.data());
         }
 
         cout<<"Deleted " << deletedCount << " rows."<<endl;
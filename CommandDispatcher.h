@@ -9,9 +9,10 @@ using namespace std;
 
 // Forward decl
 class Table; 
-class Row;
+class RowCursor;
 
 
-void PrintTable(const vector<Row*>& rows, Table* t);
+void PrintTable(RowCursor* cursor, Table* t);
+void PrintStats(bool json);
 void ExecuteCommand(const string &line);
 void ProcessDotCommand(const string &line);
\ No newline at end of file
@@ -27,8 +27,19 @@ ParsedCommand CommandParser::Parse(const string& line) {
         std::string keyword;
         ss >> keyword; 
         UPPER_CASE(keyword);
+        if (keyword == "INDEX") {
+            std::string colName;
+            if (!(ss >> cmd.tableName >> colName)) {
+                cmd.errorMessage = "Syntax Error: CREATE INDEX needs <table> <col>";
+                return cmd;
+            }
+            cmd.args.push_back(colName);
+            cmd.type = "CREATE_INDEX";
+            cmd.isValid = true;
+            return cmd;
+        }
         if (keyword != "TABLE") {
-            cmd.errorMessage = "Syntax Error: Expected 'TABLE' after CREATE";
+            cmd.errorMessage = "Syntax Error: Expected 'TABLE' or 'INDEX' after CREATE";
             return cmd;
         }
         if (!(ss >> cmd.tableName)) {
@@ -74,6 +85,13 @@ ParsedCommand CommandParser::Parse(const string& line) {
         ss >> keyword; 
         UPPER_CASE(keyword);
 
+        cmd.type = "SELECT";
+        if (keyword == "COUNT") {
+            cmd.type = "COUNT";
+            ss >> keyword;
+            UPPER_CASE(keyword);
+        }
+
         if (keyword != "FROM") {
              cmd.errorMessage = "Syntax Error: Expected 'FROM' after SELECT";
              return cmd;
@@ -83,7 +101,6 @@ ParsedCommand CommandParser::Parse(const string& line) {
              return cmd;
         }
         
-        cmd.type = "SELECT";
         cmd.isValid = true;
 
         std::string whereKw;
@@ -91,7 +108,7 @@ ParsedCommand CommandParser::Parse(const string& line) {
             UPPER_CASE(whereKw);
             if (whereKw == "WHERE") {
                 std::string col, l, r;
-                if (ss >> col >> l >> r) {
+                if (ss >> col >> quoted(l) >> quoted(r)) { // quoted: char bounds may hold spaces
                     cmd.args.push_back(col);
                     cmd.args.push_back(l);
                     cmd.args.push_back(r);
@@ -124,7 +141,7 @@ ParsedCommand CommandParser::Parse(const string& line) {
             UPPER_CASE(whereKw);
             if (whereKw == "WHERE") {
                 string col, l, r;
-                if (ss >> col >> l >> r) {
+                if (ss >> col >> quoted(l) >> quoted(r)) {
                     cmd.args.push_back(col);
                     cmd.args.push_back(l);
                     cmd.args.push_back(r);
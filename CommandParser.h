@@ -6,7 +6,7 @@
 #include <vector>
 
 struct ParsedCommand {
-    std::string type; // CREATE, INSERT, SELECT, DROP, DELETE
+    std::string type; // CREATE, CREATE_INDEX, INSERT, SELECT, COUNT, DROP, DELETE
     std::string tableName;
     std::vector<std::string> args;
     bool isValid;
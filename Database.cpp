@@ -4,10 +4,10 @@
 #include "Schema.h"
 #include "Btree.h"
 #include "Pager.h"
+#include "BufferPool.h"
 
 #include <fstream>
 #include <iostream>
-#include <algorithm> // for sort
 
 
 std::unique_ptr<Database> Database::instance = nullptr;
@@ -32,10 +32,14 @@ void Database::InitInstance(const std::string& name)
 Database::Database(const string& name)
     : metaFileName(name), running(true) 
 {
+    BufferPool::GetInstance().OpenWal(metaFileName + ".wal");
     LoadFromMeta();
 }
 
 Database::~Database(){
+    // leave clean files behind if nothing uncommitted was logged
+    BufferPool::GetInstance().Checkpoint();
+
     for(auto const& [name, table] : tables) delete table;
     tables.clear();
     running = false;
@@ -47,7 +51,7 @@ Result Database::CreateTable(const string& tableName, stringstream& ss){
         return Result::TABLE_ALREADY_EXISTS;
     }
     string dbFileName = metaFileName+"_"+tableName + ".db";
-    remove(dbFileName.c_str());
+    BufferPool::GetInstance().RemoveFile(dbFileName);
     
     Table* t = new Table(tableName, metaFileName);
     
@@ -73,6 +77,13 @@ Result Database::CreateTable(const string& tableName, stringstream& ss){
     return Result::OK;
 }
 
+Result Database::CreateIndex(const string& tableName, const string& columnName){
+    Table* t = GetTable(tableName);
+    if(!t) return Result::TABLE_NOT_FOUND;
+
+    return t->BuildIndex(columnName);
+}
+
 Table* Database::GetTable(const string& name){
     if(tables.count(name)) return tables[name];
     return nullptr;
@@ -91,62 +102,83 @@ Result Database::Insert(const string& name, stringstream& ss){
     Table* t = GetTable(name);
     if(!t) return Result::TABLE_NOT_FOUND;
 
-    Row* r = t->ParseRow(ss);
-
-    if(!r) return Result::INVALID_SCHEMA;
-    
-    t->Insert(r);
-
-    delete r;
+    Row r(t);
+    t->ParseRow(ss, r);
+    t->Insert(&r);
 
     return Result::OK;
 }
 
-void Database::SelectAll(Table* t, vector<Row*>& res){
+Result Database::Import(const string& name, const string& fileName, uint32_t& count){
+    count = 0;
+    Table* t = GetTable(name);
+    if(!t) return Result::TABLE_NOT_FOUND;
 
-    res.clear();
-    
-    for(uint32_t i = 0;i<t->rowCount; i++){
-        if(t->IsRowDeleted(i)) continue;
-        Row* r = new Row(t->schema);
-        void* slot = t->RowSlot(i, 0);
-        t->DeserializeRow(slot, r);
-        res.push_back(r);
+    ifstream ifs(fileName);
+    if(!ifs.is_open()) return Result::ERROR;
+
+    RowSet batch(t);
+    string line;
+    while(true){
+        bool more = (bool)getline(ifs, line);
+        if(more && !line.empty()){
+            stringstream ss(line);
+            Row r = batch.Append();
+            t->ParseRow(ss, r);
+        }
+        if(batch.size() == IMPORT_BATCH_ROWS || (!more && !batch.empty())){
+            t->InsertBatch(batch);
+            count += batch.size();
+            batch.Clear();
+        }
+        if(!more) break;
     }
+    return Result::OK;
 }
 
-uint32_t Database::DeleteAll(Table* t){
-    uint32_t deletedCount = 0;
-    for(uint32_t i = 0;i<t->rowCount; i++){
-        if(t->IsRowDeleted(i)) continue;
-        t->MarkRowDeleted(i);
-        deletedCount++;
-    }
-    return deletedCount;
+RowCursor* Database::OpenSelect(Table* t){
+    return t->OpenScan();
 }
 
-void Database::SelectWithRange(Table* t, const string& columnName, void* L, void* R, vector<Row*>& res){
+RowCursor* Database::OpenSelect(Table* t, const string& columnName, void* L, void* R){
+    return t->OpenRange(columnName, L, R);
+}
 
-    res.clear();
-    vector<uint32_t> selectedRowIds;
-    selectedRowIds.clear();
-    t->SelectRange(columnName, L, R, selectedRowIds);
+// Drains a cursor into a RowSet, for callers that want the whole result at once.
+static void CollectRows(RowCursor* cursor, RowSet& res){
+    if(!cursor) return;
 
-    sort(selectedRowIds.begin(), selectedRowIds.end());
+    Row r;
+    while(cursor->Next(r)) res.Add(r.data);
+    delete cursor;
+}
 
-    for(uint32_t i : selectedRowIds){
-        Row* r = new Row(t->schema);
-        void* slot = t->RowSlot(i, 0);
-        t->DeserializeRow(slot, r);
-        res.push_back(r);
-    }
+void Database::SelectAll(Table* t, RowSet& res){
+    res.Clear();
+    CollectRows(OpenSelect(t), res);
+}
+
+uint32_t Database::DeleteAll(Table* t){
+    return t->DeleteRows(t->OpenScan());
+}
 
+void Database::SelectWithRange(Table* t, const string& columnName, void* L, void* R, RowSet& res){
+    res.Clear();
+    CollectRows(OpenSelect(t, columnName, L, R), res);
 }
 
 uint32_t Database::DeleteWithRange(Table* t, const string& columnName, void* L, void* R){
     return t->DeleteRange(columnName, L, R);
 }
 
+uint32_t Database::CountAll(Table* t){
+    return t->LiveRows();
+}
+
+uint32_t Database::CountWithRange(Table* t, const string& columnName, void* L, void* R){
+    return t->CountRange(columnName, L, R);
+}
+
 void Database::FlushToMeta() {
     ofstream ofs(metaFileName+".teto");
     if(!ofs.is_open()) return;
@@ -155,11 +187,12 @@ void Database::FlushToMeta() {
     for(auto const& [name, table] : tables){
         ofs << name << " " << table->rowCount << " " << table->schema.size() << endl;
         for(Column* c : table->schema){
+            bool hasIndex = table->colIdx.count(c->columnName);
             if(c->type==INT){
-                bool hasIndex = table->colIdx.count(c->columnName);
                 ofs << c->columnName << " " << (uint8_t)c->type << " " << hasIndex << " " << c->offset << endl;
             }
-            else ofs << c->columnName << " " << (uint8_t)c->type << " " << c->size << " " << c->offset << endl;
+            // the index flag trails char columns, older catalogs end the line after the offset
+            else ofs << c->columnName << " " << (uint8_t)c->type << " " << c->size << " " << c->offset << " " << hasIndex << endl;
         }
         ofs << table->freeList.size() << endl;
         for(uint32_t i : table->freeList) ofs << i << " ";
@@ -191,7 +224,14 @@ void Database::LoadFromMeta(){
                 t->AddColumn(new Column(cName, (Type)cTypeInt, 4, cOffset));
                 if(hasIndex) t->CreateIndex(cName);
             }
-            else t->AddColumn(new Column(cName, (Type)cTypeInt, cSize, cOffset));
+            else{
+                string rest;
+                getline(ifs, rest);
+                bool hasIndex = false;
+                stringstream(rest) >> hasIndex;
+                t->AddColumn(new Column(cName, (Type)cTypeInt, cSize, cOffset));
+                if(hasIndex) t->CreateIndex(cName);
+            }
         }
 
         uint32_t freeListSize;
@@ -203,19 +243,20 @@ void Database::LoadFromMeta(){
             }
         }
 
+        t->LoadZones();
         tables[tName] = t;
     }
     ifs.close();
 }
 
 void Database::Commit(){
-    FlushToMeta();
-
+    // buffered index writes only count once they are in the tree pages
     for(auto const& [name, table] : tables){
-        if(table->pager) table->pager->FlushAll();
-
-        for(auto const& [col, tree] : table->colIdx){
-            if(tree) tree->FlushAll();
-        }
+        for(auto const& [colName, tree] : table->colIdx) tree->Flush();
+        table->SaveZones();
     }
+    FlushToMeta();
+
+    // one log write and one fsync for every table and index
+    BufferPool::GetInstance().Commit();
 }
\ No newline at end of file
@@ -11,6 +11,8 @@ using namespace std;
 
 class Table;
 class Row;
+class RowCursor;
+class RowSet;
 
 
 class Database{
@@ -23,16 +25,24 @@ public:
     Result CreateTable(const string& tableName, stringstream & ss);
     Table* GetTable(const string& name);
     Result DropTable(const string& name);
+    Result CreateIndex(const string& tableName, const string& columnName);
     Result Insert(const string& name, stringstream& ss);
-    void SelectAll(Table* t, vector<Row*> &res);
+    Result Import(const string& name, const string& fileName, uint32_t& count); // one row per line, as INSERT takes it
+    RowCursor* OpenSelect(Table* t); // streams what SelectAll collects, the caller deletes it
+    RowCursor* OpenSelect(Table* t, const string& columnName, void* L, void* R); // nullptr if there is no such column
+    void SelectAll(Table* t, RowSet& res);
     uint32_t DeleteAll(Table* t);
-    void SelectWithRange(Table* t, const string& columnName, void* L, void* R, vector<Row*>& res);
+    void SelectWithRange(Table* t, const string& columnName, void* L, void* R, RowSet& res);
     uint32_t DeleteWithRange(Table* t, const string& columnName, void* L, void* R);
+    uint32_t CountAll(Table* t);
+    uint32_t CountWithRange(Table* t, const string& columnName, void* L, void* R);
     void Commit();
     void LoadFromMeta();
     void FlushToMeta();
 
 public:
+    inline static const uint32_t IMPORT_BATCH_ROWS = 65536; // rows parsed before they go to the table together
+
     map<string, Table*> tables;
     const string metaFileName;
     bool running;
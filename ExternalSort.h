@@ -0,0 +1,133 @@
+// ExternalSort.h
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+
+const uint64_t SORT_MEMORY_BYTES = 64ull << 20; // records buffered before a run is spilled
+const uint64_t SORT_READ_BYTES = 1 << 20; // read buffer per run while merging
+
+// Sorts a stream of fixed-size records that may not fit in memory.
+// Records are buffered up to a budget; every full buffer is sorted and spilled
+// to a run file next to prefix, and Next() merges the runs back in order.
+// If everything fit, Next() just walks the sorted buffer.
+template<typename Rec, typename Less>
+class ExternalSort {
+public:
+    ExternalSort(const string& prefix, uint64_t memoryBytes = SORT_MEMORY_BYTES)
+        : prefix(prefix), maxRecords(max<uint64_t>(1, memoryBytes / sizeof(Rec))), count(0), pos(0), heap(HeapLess{this})
+    {}
+
+    ~ExternalSort(){
+        for(RunReader& r : readers) r.file.close();
+        for(uint32_t i = 0; i < runs; i++) remove(RunName(i).c_str());
+    }
+
+    void Add(const Rec& r){
+        buffer.push_back(r);
+        count++;
+        if(buffer.size() >= maxRecords) Spill();
+    }
+
+    // No more Add() after this
+    void Finish(){
+        if(runs == 0){
+            sort(buffer.begin(), buffer.end(), less);
+            return;
+        }
+
+        if(!buffer.empty()) Spill();
+        vector<Rec>().swap(buffer);
+
+        uint64_t perRun = max<uint64_t>(1, SORT_READ_BYTES / sizeof(Rec));
+        readers.resize(runs);
+        for(uint32_t i = 0; i < runs; i++){
+            readers[i].file.open(RunName(i), ios::binary);
+            readers[i].records.resize(perRun);
+            if(Fill(readers[i])) heap.push(i);
+        }
+    }
+
+    bool Next(Rec& out){
+        if(runs == 0){
+            if(pos == buffer.size()) return false;
+            out = buffer[pos++];
+            return true;
+        }
+
+        if(heap.empty()) return false;
+        uint32_t i = heap.top();
+        heap.pop();
+
+        RunReader& r = readers[i];
+        out = r.records[r.pos++];
+        if(r.pos < r.size || Fill(r)) heap.push(i);
+        return true;
+    }
+
+    uint64_t Count() const { return count; }
+    uint32_t Runs() const { return runs; }
+
+private:
+    struct RunReader{
+        ifstream file;
+        vector<Rec> records;
+        uint64_t pos = 0;
+        uint64_t size = 0;
+    };
+
+    // the priority_queue is a max-heap, so the run with the greatest head sinks
+    struct HeapLess{
+        ExternalSort* s;
+        bool operator()(uint32_t a, uint32_t b) const {
+            RunReader& ra = s->readers[a];
+            RunReader& rb = s->readers[b];
+            return s->less(rb.records[rb.pos], ra.records[ra.pos]);
+        }
+    };
+
+    string RunName(uint32_t i) const { return prefix + ".run" + to_string(i); }
+
+    void Spill(){
+        sort(buffer.begin(), buffer.end(), less);
+
+        string name = RunName(runs++);
+        ofstream ofs(name, ios::binary | ios::trunc);
+        ofs.write((const char*)buffer.data(), buffer.size() * sizeof(Rec));
+        if(!ofs){
+            cerr << "Error: Unable to write sort run " << name << endl;
+            exit(1);
+        }
+        buffer.clear();
+    }
+
+    bool Fill(RunReader& r){
+        r.file.read((char*)r.records.data(), r.records.size() * sizeof(Rec));
+        r.size = r.file.gcount() / sizeof(Rec);
+        r.pos = 0;
+        return r.size > 0;
+    }
+
+private:
+    string prefix;
+    uint64_t maxRecords;
+    uint64_t count;
+    uint32_t runs = 0;
+    Less less;
+
+    vector<Rec> buffer;
+    uint64_t pos; // next record when everything fit in memory
+
+    vector<RunReader> readers;
+    priority_queue<uint32_t, vector<uint32_t>, HeapLess> heap;
+};
@@ -0,0 +1,65 @@
+// FixedKey.h
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+
+const uint32_t MAX_KEY_SIZE = 256; // widest char column that can be indexed
+
+// A char(N) column value as a B+ tree key. Values are zero-padded, so comparing all
+// N bytes with memcmp (vectorized by the C library) orders them like strcmp would,
+// and a column narrower than N compares the same once widened with zeros.
+template<uint32_t N>
+struct FixedKey{
+    char bytes[N];
+
+    bool operator<(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) < 0; }
+    bool operator>(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) > 0; }
+    bool operator<=(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) <= 0; }
+    bool operator>=(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) >= 0; }
+    bool operator==(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) == 0; }
+    bool operator!=(const FixedKey& o) const { return memcmp(bytes, o.bytes, N) != 0; }
+};
+
+// Reads the key of a column that is size bytes wide
+template<typename T>
+struct KeyLoader{
+    static T Load(const void* src, uint32_t /*size*/){
+        T key;
+        memcpy(&key, src, sizeof(T));
+        return key;
+    }
+};
+
+template<uint32_t N>
+struct KeyLoader<FixedKey<N>>{
+    static FixedKey<N> Load(const void* src, uint32_t size){
+        FixedKey<N> key;
+        uint32_t len = min(size, N);
+        memcpy(key.bytes, src, len);
+        memset(key.bytes + len, 0, N - len);
+        return key;
+    }
+};
+
+template<typename T>
+inline T LoadKey(const void* src, uint32_t size){
+    return KeyLoader<T>::Load(src, size);
+}
+
+// Calls visit(FixedKey<N>()) with the narrowest key type that holds size bytes.
+// Only these widths are instantiated, each tree or scan rounds its column up to one.
+template<typename Visit>
+inline auto VisitFixedKey(uint32_t size, Visit visit){
+    if(size <= 8) return visit(FixedKey<8>());
+    if(size <= 16) return visit(FixedKey<16>());
+    if(size <= 32) return visit(FixedKey<32>());
+    if(size <= 64) return visit(FixedKey<64>());
+    if(size <= 128) return visit(FixedKey<128>());
+    return visit(FixedKey<MAX_KEY_SIZE>());
+}
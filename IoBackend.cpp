@@ -0,0 +1,267 @@
+// IoBackend.cpp
+
+#include "IoBackend.h"
+#include "Platform.h"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+
+
+unique_ptr<IoBackend> IoBackend::Create(IoBackendType type){
+#ifdef __linux__
+    if(type == IoBackendType::URING){
+        unique_ptr<UringIo> uring = make_unique<UringIo>();
+        if(uring->Setup()) return uring;
+        cerr << "Warning: io_uring is not available, using pread/pwrite" << endl;
+    }
+#else
+    if(type == IoBackendType::URING) cerr << "Warning: io_uring needs Linux, using pread/pwrite" << endl;
+#endif
+    return make_unique<IoBackend>();
+}
+
+bool IoBackend::Read(int fd, uint64_t offset, void* dest, uint32_t length){
+    char* p = (char*)dest;
+    while(length > 0){
+#ifdef _WIN32
+        lseek(fd, offset, SEEK_SET);
+        ssize_t n = read(fd, p, length);
+#else
+        ssize_t n = pread(fd, p, length, offset);
+#endif
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false; // error or end of file
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool IoBackend::Write(int fd, uint64_t offset, const void* src, uint32_t length){
+    const char* p = (const char*)src;
+    while(length > 0){
+#ifdef _WIN32
+        lseek(fd, offset, SEEK_SET);
+        ssize_t n = write(fd, p, length);
+#else
+        ssize_t n = pwrite(fd, p, length, offset);
+#endif
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool IoBackend::ReadV(int fd, uint64_t offset, const iovec* iov, uint32_t count){
+#ifdef _WIN32
+    return Remainder(fd, offset, iov, count, 0, false);
+#else
+    ssize_t n;
+    do n = preadv(fd, iov, count, offset); while(n < 0 && errno == EINTR);
+    if(n < 0) return false;
+    return Remainder(fd, offset, iov, count, n, false);
+#endif
+}
+
+bool IoBackend::WriteV(int fd, uint64_t offset, const iovec* iov, uint32_t count){
+#ifdef _WIN32
+    return Remainder(fd, offset, iov, count, 0, true);
+#else
+    ssize_t n;
+    do n = pwritev(fd, iov, count, offset); while(n < 0 && errno == EINTR);
+    if(n < 0) return false;
+    return Remainder(fd, offset, iov, count, n, true);
+#endif
+}
+
+// Finishes a vectored transfer after its first `done` bytes, one buffer at a time
+bool IoBackend::Remainder(int fd, uint64_t offset, const iovec* iov, uint32_t count, uint64_t done, bool isWrite){
+    for(uint32_t i = 0; i < count; i++){
+        uint64_t len = iov[i].iov_len;
+        if(done >= len){
+            done -= len;
+            offset += len;
+            continue;
+        }
+
+        char* p = (char*)iov[i].iov_base + done;
+        bool ok = isWrite ? Write(fd, offset + done, p, len - done) : Read(fd, offset + done, p, len - done);
+        if(!ok) return false;
+        offset += len;
+        done = 0;
+    }
+    return true;
+}
+
+bool IoBackend::Transfer(IoRequest& req){
+    if(req.iov) return req.isWrite ? WriteV(req.fd, req.offset, req.iov, req.iovCount) : ReadV(req.fd, req.offset, req.iov, req.iovCount);
+    return req.isWrite ? Write(req.fd, req.offset, req.buffer, req.length) : Read(req.fd, req.offset, req.buffer, req.length);
+}
+
+void IoBackend::Submit(vector<IoRequest>& batch){
+    for(IoRequest& req : batch){
+        if(!Transfer(req)) failed = true;
+    }
+}
+
+bool IoBackend::WaitAll(){
+    return !failed.exchange(false);
+}
+
+
+#ifdef __linux__
+
+bool UringIo::Setup(){
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    if(ringFd < 0) return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMap) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if(sqRing == MAP_FAILED){
+        sqRing = nullptr;
+        return false;
+    }
+
+    if(singleMap) cqRing = sqRing;
+    else{
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if(cqRing == MAP_FAILED){
+            cqRing = nullptr;
+            return false;
+        }
+    }
+
+    sqEntries = params.sq_entries;
+    sqes = (io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        sqes = nullptr;
+        return false;
+    }
+
+    char* sq = (char*)sqRing;
+    sqHead = (uint32_t*)(sq + params.sq_off.head);
+    sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    sqMask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    sqArray = (uint32_t*)(sq + params.sq_off.array);
+
+    char* cq = (char*)cqRing;
+    cqHead = (uint32_t*)(cq + params.cq_off.head);
+    cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    cqMask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    uint32_t depth = min(URING_QUEUE_DEPTH, params.sq_entries);
+    slots.assign(depth, nullptr);
+    for(uint32_t i = 0; i < depth; i++) freeSlots.push_back(depth - 1 - i);
+
+    return true;
+}
+
+UringIo::~UringIo(){
+    if(ringFd < 0) return;
+    if(sqes) WaitAll();
+
+    if(sqes) munmap(sqes, sqEntries * sizeof(io_uring_sqe));
+    if(cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if(sqRing) munmap(sqRing, sqRingSize);
+    close(ringFd);
+}
+
+void UringIo::Submit(vector<IoRequest>& batch){
+    lock_guard<mutex> lock(mtx);
+
+    for(IoRequest& req : batch){
+        if(freeSlots.empty()) Reap(1); // queue full, wait for a completion
+
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot] = &req;
+
+        uint32_t tail = *sqTail;
+        uint32_t idx = tail & *sqMask;
+
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = req.fd;
+        if(req.iov){
+            sqe->opcode = req.isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = (uint64_t)req.iov;
+            sqe->len = req.iovCount;
+        }
+        else{
+            sqe->opcode = req.isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->addr = (uint64_t)req.buffer;
+            sqe->len = req.length;
+        }
+        sqe->off = req.offset;
+        sqe->user_data = slot;
+
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        pendingSubmit++;
+    }
+
+    Reap(0); // hand everything to the kernel, don't wait
+}
+
+bool UringIo::WaitAll(){
+    lock_guard<mutex> lock(mtx);
+
+    while(freeSlots.size() < slots.size()) Reap(1);
+
+    return !failed.exchange(false);
+}
+
+void UringIo::Reap(uint32_t minComplete){
+    while(pendingSubmit > 0 || minComplete > 0){
+        uint32_t flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int ret = syscall(__NR_io_uring_enter, ringFd, pendingSubmit, minComplete, flags, nullptr, 0);
+        if(ret < 0){
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            cerr << "Error: io_uring_enter failed: " << strerror(errno) << endl;
+            exit(1);
+        }
+        pendingSubmit -= min<uint32_t>(ret, pendingSubmit);
+        break;
+    }
+
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while(head != tail){
+        io_uring_cqe* cqe = &cqes[head & *cqMask];
+        uint32_t slot = cqe->user_data;
+        Finish(slots[slot], cqe->res);
+        slots[slot] = nullptr;
+        freeSlots.push_back(slot);
+        head++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+void UringIo::Finish(IoRequest* req, int32_t res){
+    if(res == (int32_t)req->length) return;
+
+    // short transfer or an opcode the kernel rejected: finish it synchronously
+    if(!Transfer(*req)) failed = true;
+}
+
+#endif
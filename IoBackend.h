@@ -0,0 +1,102 @@
+// IoBackend.h
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#ifdef _WIN32
+    #include <cstddef>
+    struct iovec{
+        void* iov_base;
+        size_t iov_len;
+    };
+#else
+    #include <sys/uio.h> // iovec
+#endif
+
+using namespace std;
+
+
+enum class IoBackendType { POSIX, URING };
+
+struct IoRequest{
+    int fd;
+    uint64_t offset;
+    void* buffer;
+    uint32_t length; // total bytes, also for vectored requests
+    bool isWrite;
+    const iovec* iov = nullptr; // if set, a vectored request over iovCount buffers instead of buffer
+    uint32_t iovCount = 0;
+};
+
+// How pages move between memory and disk.
+// Read/Write are synchronous. Submit starts a batch and may return before it finishes;
+// the requests (and their buffers) must stay alive until WaitAll returns.
+class IoBackend{
+public:
+    virtual ~IoBackend() = default;
+
+    virtual bool Read(int fd, uint64_t offset, void* dest, uint32_t length);
+    virtual bool Write(int fd, uint64_t offset, const void* src, uint32_t length);
+    virtual bool ReadV(int fd, uint64_t offset, const iovec* iov, uint32_t count);
+    virtual bool WriteV(int fd, uint64_t offset, const iovec* iov, uint32_t count); // one pwritev for adjacent pages
+
+    virtual void Submit(vector<IoRequest>& batch);
+    virtual bool WaitAll(); // false if any request since the last WaitAll failed
+
+    virtual const char* Name() { return "posix"; }
+
+    static unique_ptr<IoBackend> Create(IoBackendType type);
+
+protected:
+    bool Transfer(IoRequest& req); // runs one request synchronously
+    bool Remainder(int fd, uint64_t offset, const iovec* iov, uint32_t count, uint64_t done, bool isWrite);
+
+protected:
+    atomic<bool> failed = false; // set by whichever thread finishes a request
+};
+
+#ifdef __linux__
+
+// Keeps up to URING_QUEUE_DEPTH requests in flight through io_uring.
+class UringIo : public IoBackend{
+public:
+    ~UringIo() override;
+
+    bool Setup();
+
+    void Submit(vector<IoRequest>& batch) override;
+    bool WaitAll() override;
+
+    const char* Name() override { return "io_uring"; }
+
+    inline static const uint32_t URING_QUEUE_DEPTH = 64;
+
+private:
+    void Reap(uint32_t minComplete);
+    void Finish(IoRequest* req, int32_t res);
+
+private:
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    uint32_t sqEntries = 0;
+
+    uint32_t* sqHead; uint32_t* sqTail; uint32_t* sqMask; uint32_t* sqArray;
+    uint32_t* cqHead; uint32_t* cqTail; uint32_t* cqMask;
+    struct io_uring_cqe* cqes;
+
+    vector<IoRequest*> slots; // user_data -> request, nullptr when free
+    vector<uint32_t> freeSlots;
+    uint32_t pendingSubmit = 0;
+    mutex mtx;
+};
+
+#endif
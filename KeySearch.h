@@ -0,0 +1,109 @@
+// KeySearch.h
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define TETO_X86_SIMD
+#endif
+
+using namespace std;
+
+
+const uint32_t KEY_SEARCH_BLOCK = 32; // keys left when the halving stops and every key is compared
+
+// Number of keys in the sorted keys[0, n) that are < key, or <= key if orEqual.
+// This is the slot a search stops at: lower bound, or upper bound with orEqual.
+template<typename T>
+inline uint32_t KeyRank(const T* keys, uint32_t n, const T& key, bool orEqual){
+    uint32_t lo = 0, hi = n;
+    while(lo < hi){
+        uint32_t mid = (lo + hi) / 2;
+        bool before = orEqual ? !(key < keys[mid]) : keys[mid] < key;
+        if(before) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+#ifdef TETO_X86_SIMD
+
+__attribute__((target("avx2")))
+inline uint32_t CountBeforeAvx2(const int32_t* keys, uint32_t n, int32_t key, bool orEqual){
+    __m256i k = _mm256_set1_epi32(key);
+    uint32_t count = 0, i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+        __m256i m = orEqual ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+    }
+    for(; i < n; i++) count += orEqual ? keys[i] > key : keys[i] < key;
+    return orEqual ? n - count : count; // with orEqual the keys after key were counted
+}
+
+#ifdef __SSE2__ // always there on x86-64
+inline uint32_t CountBeforeSse2(const int32_t* keys, uint32_t n, int32_t key, bool orEqual){
+    __m128i k = _mm_set1_epi32(key);
+    uint32_t count = 0, i = 0;
+    for(; i + 4 <= n; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+        __m128i m = orEqual ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+    }
+    for(; i < n; i++) count += orEqual ? keys[i] > key : keys[i] < key;
+    return orEqual ? n - count : count;
+}
+#endif
+
+inline bool HasAvx2(){
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+#endif
+
+// Same count as KeyRank, but every one of the n keys is compared: 8 per instruction
+// with AVX2 (checked at runtime), 4 with SSE2, one at a time elsewhere
+inline uint32_t CountBefore(const int32_t* keys, uint32_t n, int32_t key, bool orEqual){
+#ifdef TETO_X86_SIMD
+    if(HasAvx2()) return CountBeforeAvx2(keys, n, key, orEqual);
+    #ifdef __SSE2__
+    return CountBeforeSse2(keys, n, key, orEqual);
+    #endif
+#endif
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < n; i++) count += orEqual ? keys[i] <= key : keys[i] < key;
+    return count;
+}
+
+// Branch-free halving down to one block, then the whole block is compared at once.
+// Everything before base is known to be before key, everything past base + n is not.
+template<>
+inline uint32_t KeyRank<int32_t>(const int32_t* keys, uint32_t n, const int32_t& key, bool orEqual){
+    const int32_t* base = keys;
+    while(n > KEY_SEARCH_BLOCK){
+        uint32_t half = n / 2;
+        bool before = orEqual ? base[half] <= key : base[half] < key;
+        base = before ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + CountBefore(base, n, key, orEqual);
+}
+
+// KeyRank for when the answer is expected near the front, such as the end of a run of
+// equal keys: probes 1, 2, 4, ... keys in, then searches only the last gap
+template<typename T>
+inline uint32_t KeyRankNear(const T* keys, uint32_t n, const T& key, bool orEqual){
+    uint32_t lo = 0, step = 1;
+    while(lo < n){
+        uint32_t probe = min(lo + step, n) - 1;
+        bool before = orEqual ? !(key < keys[probe]) : keys[probe] < key;
+        if(!before) return lo + KeyRank(keys + lo, probe - lo, key, orEqual);
+        lo = probe + 1;
+        step *= 2;
+    }
+    return n;
+}
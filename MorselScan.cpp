@@ -0,0 +1,150 @@
+// MorselScan.cpp
+
+#include "MorselScan.h"
+#include "WorkerPool.h"
+#include "PageScan.h"
+#include "Schema.h"
+#include "Pager.h"
+
+#include <algorithm>
+
+
+uint32_t MorselScan::Workers(Table* t){
+    if(t->rowsPerPage == 0) return 1;
+    uint32_t rowsPerMorsel = MORSEL_PAGES * t->rowsPerPage;
+    uint32_t morsels = (t->rowCount + rowsPerMorsel - 1) / rowsPerMorsel;
+
+    // every worker keeps a page pinned, most of the pool stays for everything else
+    uint32_t workers = min({ WorkerPool::GetInstance().Size(), morsels, BufferPool::GetInstance().MAX_PAGES / 8 });
+    return max(workers, 1u);
+}
+
+shared_ptr<MorselScan> MorselScan::Start(Table* t, PageFilter filter, uint32_t workers, bool countOnly){
+    shared_ptr<MorselScan> scan = make_shared<MorselScan>(t, move(filter), workers, countOnly);
+    for(uint32_t i = 1; i < workers; i++){
+        WorkerPool::GetInstance().Submit([scan]{ scan->Work(); });
+    }
+    return scan;
+}
+
+MorselScan::MorselScan(Table* t, PageFilter filter, uint32_t workers, bool countOnly)
+    : table(t), filter(move(filter)), countOnly(countOnly), rowCount(t->rowCount),
+      window(2 * workers), next(0), taken(0), active(0), stopped(0)
+{
+    uint32_t rowsPerMorsel = MORSEL_PAGES * t->rowsPerPage;
+    morsels = (rowCount + rowsPerMorsel - 1) / rowsPerMorsel;
+}
+
+void MorselScan::Work(){
+    while(true){
+        uint32_t m;
+        {
+            unique_lock<mutex> lock(mtx);
+            changed.wait(lock, [&]{ return stopped || next >= morsels || next < taken + window.size(); });
+            if(stopped || next >= morsels) return;
+            m = next++;
+            active++;
+        }
+
+        vector<uint32_t> rowIds;
+        uint64_t count = 0;
+        Filter(m, rowIds, count);
+
+        {
+            lock_guard<mutex> lock(mtx);
+            Morsel& slot = window[m % window.size()];
+            slot.rowIds = move(rowIds);
+            slot.count = count;
+            slot.done = true;
+            active--;
+        }
+        changed.notify_all();
+    }
+}
+
+void MorselScan::Filter(uint32_t m, vector<uint32_t>& rowIds, uint64_t& count){
+    uint32_t rowsPerPage = table->rowsPerPage;
+    uint32_t first = m * MORSEL_PAGES * rowsPerPage;
+    uint32_t end = min(rowCount, first + MORSEL_PAGES * rowsPerPage);
+    Pager* pager = table->pager;
+
+    // only the pages that may match are hinted and read
+    vector<uint32_t> pages;
+    for(uint32_t pageFirst = first; pageFirst < end; pageFirst += rowsPerPage){
+        uint32_t pageNum = pageFirst / rowsPerPage;
+        if(!filter.mayMatch || filter.mayMatch(pageNum)) pages.push_back(pageNum);
+    }
+    pager->Prefetch(pages);
+
+    uint64_t mask[PAGE_SIZE / 64];
+    for(uint32_t i = 0; i < pages.size(); i++){
+        if(i % Pager::READ_BATCH_PAGES == 0) pager->ReadPages(&pages[i], min<size_t>(Pager::READ_BATCH_PAGES, pages.size() - i));
+
+        uint32_t pageNum = pages[i];
+        uint32_t pageFirst = pageNum * rowsPerPage;
+        uint32_t n = min(rowsPerPage, end - pageFirst);
+
+        const char* page = (const char*)pager->PinPage(pageNum, 0);
+        if(!page) continue;
+        filter.select(page, n, mask);
+        if(!pager->IsMapped(page)) pager->UnpinPage(pageNum);
+
+        for(uint32_t w = 0; w < (n + 63) / 64; w++){
+            uint64_t bits = mask[w];
+            count += __builtin_popcountll(bits);
+            if(countOnly) continue;
+            for(; bits; bits &= bits - 1) rowIds.push_back(pageFirst + w * 64 + __builtin_ctzll(bits));
+        }
+    }
+}
+
+bool MorselScan::TakeNext(vector<uint32_t>& rowIds, uint64_t& count){
+    unique_lock<mutex> lock(mtx);
+    if(taken >= morsels) return false;
+
+    Morsel& slot = window[taken % window.size()];
+    while(!slot.done){
+        if(next == taken){
+            // no worker got to it yet, maybe all of them are busy with other scans
+            next++;
+            lock.unlock();
+            vector<uint32_t> ids;
+            uint64_t c = 0;
+            Filter(taken, ids, c);
+            lock.lock();
+            slot.rowIds = move(ids);
+            slot.count = c;
+            slot.done = true;
+            break;
+        }
+        changed.wait(lock);
+    }
+
+    rowIds.swap(slot.rowIds);
+    slot.rowIds.clear();
+    count = slot.count;
+    slot.done = false;
+    taken++;
+    lock.unlock();
+    changed.notify_all();
+    return true;
+}
+
+bool MorselScan::Take(vector<uint32_t>& rowIds){
+    uint64_t count;
+    return TakeNext(rowIds, count);
+}
+
+uint64_t MorselScan::Count(){
+    vector<uint32_t> rowIds;
+    uint64_t total = 0, count;
+    while(TakeNext(rowIds, count)) total += count;
+    return total;
+}
+
+void MorselScan::Stop(){
+    unique_lock<mutex> lock(mtx);
+    stopped = true;
+    changed.notify_all();
+    changed.wait(lock, [&]{ return active == 0; });
+}
@@ -0,0 +1,76 @@
+// MorselScan.h
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+using namespace std;
+
+class Table;
+
+
+// How a scan picks its rows, called from several threads at once: mayMatch rules out
+// pages without reading them (see ZoneMap), select marks the slots of a page that was
+// read in a bitmask (see PageScan.h).
+struct PageFilter{
+    function<bool(uint32_t pageNum)> mayMatch; // empty: every page is read
+    function<void(const char* page, uint32_t n, uint64_t* mask)> select;
+};
+
+// A scan split into morsels of MORSEL_PAGES heap pages that the WorkerPool filters in
+// parallel: each worker takes the next morsel as soon as it is done with its last, and
+// runs at most a window of morsels ahead of the reader. The reader takes the results
+// in morsel order, so the rowIds come out as a serial scan yields them; when the morsel
+// it waits for has not been started, the reader filters it itself.
+// Only the heap pages are read by the workers, the table must not change meanwhile
+// except for rows of morsels that were already taken (see Table::DeleteRows). Workers
+// load pages while the reader runs, so any frame the reader doesn't pin can be reused
+// under it: the reader pins every heap page it reads or writes (RowCursor::Next,
+// Table::DeleteRow, Table::MarkRowDeleted).
+class MorselScan{
+public:
+    static const uint32_t MORSEL_PAGES = 64;
+
+    // Threads worth using on t: 1 when the pool has none to spare or the table is
+    // too small to split
+    static uint32_t Workers(Table* t);
+
+    // Submits workers - 1 tasks to the pool. With countOnly the morsels only count their rows.
+    static shared_ptr<MorselScan> Start(Table* t, PageFilter filter, uint32_t workers, bool countOnly);
+
+    MorselScan(Table* t, PageFilter filter, uint32_t workers, bool countOnly);
+
+    bool Take(vector<uint32_t>& rowIds); // the next morsel's rowIds, false once every morsel was taken
+    uint64_t Count(); // the rows of every morsel not taken yet
+    void Stop(); // returns once no worker is inside a morsel; the rest are never started
+
+private:
+    void Work(); // a pool task: filters morsels until there are none left
+    void Filter(uint32_t m, vector<uint32_t>& rowIds, uint64_t& count);
+    bool TakeNext(vector<uint32_t>& rowIds, uint64_t& count);
+
+    struct Morsel{
+        vector<uint32_t> rowIds;
+        uint64_t count = 0;
+        bool done = false;
+    };
+
+    Table* table;
+    PageFilter filter;
+    bool countOnly;
+    uint32_t rowCount; // rows when the scan started
+    uint32_t morsels;
+
+    mutex mtx;
+    condition_variable changed;
+    vector<Morsel> window; // morsel m waits in window[m % window.size()] until taken
+    uint32_t next;     // first morsel no thread has started
+    uint32_t taken;    // morsels handed to the reader
+    uint32_t active;   // workers inside a morsel
+    bool stopped;
+};
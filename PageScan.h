@@ -0,0 +1,88 @@
+// PageScan.h
+
+#pragma once
+
+#include "FixedKey.h"
+#include "KeySearch.h" // TETO_X86_SIMD, HasAvx2
+
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+
+// Filters the n row slots of one heap page at once. Slot i starts at page + i * rowSize
+// with the deleted flag in its first byte. Bit i of mask (word i / 64, (n + 63) / 64 words)
+// is set when row i is live and, for a range filter, its column at offset is in [L, R].
+// The caller reads the page once and then walks the set bits, see ScanCursor.
+
+inline void ClearMask(uint64_t* mask, uint32_t n){
+    memset(mask, 0, (n + 63) / 64 * sizeof(uint64_t));
+}
+
+inline void LiveSlots(const char* page, uint32_t n, uint32_t rowSize, uint64_t* mask){
+    ClearMask(mask, n);
+    for(uint32_t i = 0; i < n; i++){
+        mask[i / 64] |= (uint64_t)(page[i * rowSize] != 1) << (i % 64);
+    }
+}
+
+template<typename T>
+inline void FilterSlots(const char* page, uint32_t n, uint32_t rowSize, uint32_t offset, uint32_t size,
+                        const T& L, const T& R, uint64_t* mask){
+    ClearMask(mask, n);
+    for(uint32_t i = 0; i < n; i++){
+        const char* slot = page + i * rowSize;
+        T key = LoadKey<T>(slot + offset, size);
+        bool keep = slot[0] != 1 && L <= key && key <= R;
+        mask[i / 64] |= (uint64_t)keep << (i % 64);
+    }
+}
+
+#ifdef TETO_X86_SIMD
+
+// 8 slots per step: one gather pulls the 8 column values, another the 4 bytes that start
+// each slot (the flag and what follows; an int column makes every slot at least 5 bytes).
+// 8 divides 64, so a step's bits never straddle two mask words.
+__attribute__((target("avx2")))
+inline uint32_t FilterSlotsAvx2(const char* page, uint32_t n, uint32_t rowSize, uint32_t offset,
+                                int32_t L, int32_t R, uint64_t* mask){
+    __m256i lo = _mm256_set1_epi32(L);
+    __m256i hi = _mm256_set1_epi32(R);
+    __m256i flagByte = _mm256_set1_epi32(0xFF);
+    __m256i dead = _mm256_set1_epi32(1);
+    __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(rowSize));
+    __m256i step = _mm256_set1_epi32(8 * rowSize);
+
+    uint32_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_i32gather_epi32((const int*)(page + offset), idx, 1);
+        __m256i flag = _mm256_and_si256(_mm256_i32gather_epi32((const int*)page, idx, 1), flagByte);
+        __m256i drop = _mm256_or_si256(_mm256_cmpgt_epi32(lo, v), _mm256_cmpgt_epi32(v, hi));
+        drop = _mm256_or_si256(drop, _mm256_cmpeq_epi32(flag, dead));
+        uint64_t keep = ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(drop)) & 0xFF;
+        mask[i / 64] |= keep << (i % 64);
+        idx = _mm256_add_epi32(idx, step);
+    }
+    return i; // slots left for the scalar loop
+}
+
+#endif
+
+// int columns compare 8 slots per instruction with AVX2 (checked at runtime)
+template<>
+inline void FilterSlots<int32_t>(const char* page, uint32_t n, uint32_t rowSize, uint32_t offset, uint32_t /*size*/,
+                                 const int32_t& L, const int32_t& R, uint64_t* mask){
+    ClearMask(mask, n);
+    uint32_t i = 0;
+#ifdef TETO_X86_SIMD
+    if(HasAvx2()) i = FilterSlotsAvx2(page, n, rowSize, offset, L, R, mask);
+#endif
+    for(; i < n; i++){
+        const char* slot = page + i * rowSize;
+        int32_t key;
+        memcpy(&key, slot + offset, sizeof(key));
+        bool keep = slot[0] != 1 && L <= key && key <= R;
+        mask[i / 64] |= (uint64_t)keep << (i % 64);
+    }
+}
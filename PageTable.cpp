@@ -0,0 +1,52 @@
+// PageTable.cpp
+
+#include "PageTable.h"
+
+
+
+void PageTable::Init(uint32_t maxEntries){
+    uint64_t capacity = 16;
+    shift = 60;
+    while(capacity < (uint64_t)maxEntries * 2){
+        capacity <<= 1;
+        shift--;
+    }
+
+    entries.assign(capacity, {EMPTY, NO_FRAME});
+    mask = capacity - 1;
+    count = 0;
+}
+
+void PageTable::Insert(uint64_t key, uint32_t frame){
+    uint64_t i = Slot(key);
+    while(entries[i].key != EMPTY && entries[i].key != key) i = (i + 1) & mask;
+
+    if(entries[i].key == EMPTY) count++;
+    entries[i] = {key, frame};
+}
+
+void PageTable::Erase(uint64_t key){
+    uint64_t i = Slot(key);
+    while(entries[i].key != key){
+        if(entries[i].key == EMPTY) return;
+        i = (i + 1) & mask;
+    }
+
+    // backward shift: pull later entries of the probe run into the hole
+    uint64_t hole = i;
+    uint64_t j = i;
+    while(true){
+        j = (j + 1) & mask;
+        if(entries[j].key == EMPTY) break;
+
+        uint64_t home = Slot(entries[j].key);
+        // entries[j] may move back only if its home is not inside (hole, j]
+        if(((j - home) & mask) >= ((j - hole) & mask)){
+            entries[hole] = entries[j];
+            hole = j;
+        }
+    }
+
+    entries[hole] = {EMPTY, NO_FRAME};
+    count--;
+}
@@ -0,0 +1,53 @@
+// PageTable.h
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+
+const uint32_t NO_FRAME = UINT32_MAX;
+
+// Maps (fileId, pageNum) keys to frame ids for the BufferPool.
+// Open addressing with linear probing in one flat array. It is sized once for the
+// pool's frame count at no more than half full, so it never rehashes, and deletes
+// shift later entries back instead of leaving tombstones.
+class PageTable {
+public:
+    void Init(uint32_t maxEntries);
+
+    uint32_t Find(uint64_t key) const { // NO_FRAME if absent
+        uint64_t i = Slot(key);
+        while(true){
+            const Entry& e = entries[i];
+            if(e.key == key) return e.frame;
+            if(e.key == EMPTY) return NO_FRAME;
+            i = (i + 1) & mask;
+        }
+    }
+
+    void Insert(uint64_t key, uint32_t frame); // replaces an existing entry
+    void Erase(uint64_t key);
+
+    uint32_t Size() const { return count; }
+
+private:
+    uint64_t Slot(uint64_t key) const {
+        return (key * 0x9E3779B97F4A7C15ull) >> shift; // Fibonacci hashing, top bits
+    }
+
+private:
+    struct Entry{
+        uint64_t key;
+        uint32_t frame;
+    };
+
+    static const uint64_t EMPTY = UINT64_MAX; // keys only use 48 bits
+
+    vector<Entry> entries;
+    uint64_t mask = 0;
+    uint32_t shift = 64;
+    uint32_t count = 0;
+};
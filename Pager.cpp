@@ -3,47 +3,32 @@
 #include "Pager.h"
 
 #include <iostream>
-#include <algorithm> // for std::max
+#include <algorithm> // for std::max, std::sort
 #include <cstring>   // for memset
-#include <fcntl.h>   // open flags
-#include <sys/stat.h> // fstat
-
-#ifdef _WIN32
-    #include <io.h>
-    #define S_IWUSR S_IWRITE
-    #define S_IRUSR S_IREAD
-    #define open _open
-    #define close _close
-    #define read _read
-    #define write _write
-    #define lseek _lseek
-    #define chsize _chsize // For truncating
-    #include <cstddef>
-    using ssize_t = ptrdiff_t;
-#else
-    #include <unistd.h>
-    #define O_BINARY 0
-#endif
+
+#include "Platform.h"
+#include "Wal.h"
 
 
 
 
 using namespace std;
 
-Pager::Pager(const string& fileName, uint32_t maxPages)
-    : MAX_PAGES(maxPages), fileName(fileName), clockHand(0)
+Pager::Pager(const string& fileName)
+    : fileName(fileName), mapping(nullptr), mappedLength(0), scanDepth(0), scanHand(0), lastMiss(UINT32_MAX - 1), readAheadStart(0), readAheadEnd(0)
 {
-    fileDescriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_BINARY, S_IWUSR | S_IRUSR);
+    BufferPool& pool = BufferPool::GetInstance();
 
-    if(fileDescriptor == -1){
-        std::cerr << "Error: Unable to open file " << fileName << std::endl;
-        exit(1);
+    directIo = false;
+    if(pool.directIo){
+        fileDescriptor = OpenDirect(fileName.c_str());
+        directIo = fileDescriptor != (uint32_t)-1;
+        if(!directIo) cerr << "Warning: Unable to open " << fileName << " with direct I/O, using the OS cache" << endl;
     }
+    if(!directIo) fileDescriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_BINARY, S_IWUSR | S_IRUSR);
 
-    string tempName = fileName + ".tmp";
-    tempFileDescriptor = open(tempName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_BINARY, S_IWUSR | S_IRUSR);
-    if(tempFileDescriptor == -1){
-        cerr << "Error: Unable to open temp file " << tempName << endl;
+    if(fileDescriptor == (uint32_t)-1){
+        std::cerr << "Error: Unable to open file " << fileName << std::endl;
         exit(1);
     }
 
@@ -54,13 +39,6 @@ Pager::Pager(const string& fileName, uint32_t maxPages)
     else{
         fileLength = 0;
     }
-    
-
-    buffers.resize(MAX_PAGES);
-    for(int i=0; i<MAX_PAGES; i++){
-        buffers[i].data = malloc(PAGE_SIZE);
-        buffers[i].flags = 0;
-    }
 
     if(fileLength % PAGE_SIZE != 0){
         cerr << "DB file is not a whole number of pages" << endl;
@@ -68,145 +46,367 @@ Pager::Pager(const string& fileName, uint32_t maxPages)
     }
 
     numPages = fileLength/PAGE_SIZE;
+
+    fileId = pool.RegisterFile(this);
+    if(pool.mmapFiles) Map();
 }
 
 Pager::~Pager(){
-    for(PageBuffer &p : buffers) free(p.data);
+    BufferPool::GetInstance().closedStats += stats;
+    BufferPool::GetInstance().UnregisterFile(fileId);
+    Unmap();
     close(fileDescriptor);
-    close(tempFileDescriptor);
-    string tempName = fileName+".tmp";
-    if(remove(tempName.c_str()) != 0){
-        cerr << "Warning: Could not delete temp file " << tempName << endl;
+}
+
+void Pager::Map(){
+#ifndef _WIN32
+    Unmap();
+    if(fileLength == 0) return;
+
+    void* m = mmap(nullptr, fileLength, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if(m == MAP_FAILED){
+        cerr << "Warning: Unable to map " << fileName << ", reading it through the pool" << endl;
+        return;
     }
+    mapping = (char*)m;
+    mappedLength = fileLength;
+#endif
+}
+
+void Pager::Unmap(){
+#ifndef _WIN32
+    if(mapping) munmap(mapping, mappedLength);
+#endif
+    mapping = nullptr;
+    mappedLength = 0;
+}
+
+void* Pager::MappedPage(uint32_t pageNum){
+    if(!mapping || (uint64_t)pageNum * PAGE_SIZE >= mappedLength) return nullptr;
+    if(walPages.find(pageNum) != walPages.end()) return nullptr; // newer image in the log
+
+    BufferPool& pool = BufferPool::GetInstance();
+    if(pool.pageTable.Find(BufferPool::FrameKey(fileId, pageNum)) != NO_FRAME) return nullptr; // possibly changed
+
+    return mapping + (uint64_t)pageNum * PAGE_SIZE;
 }
 
 
 void Pager::WritePage(uint32_t fd, uint32_t pageNum, void* data){
-    off_t offset = (off_t)pageNum * PAGE_SIZE;
-    lseek(fd, offset, SEEK_SET);
-    write(fd, data, PAGE_SIZE);
+    if(!BufferPool::GetInstance().io->Write(fd, (uint64_t)pageNum * PAGE_SIZE, data, PAGE_SIZE)){
+        cerr << "Error: Failed to write page " << pageNum << " of " << fileName << endl;
+        exit(1);
+    }
 }
 
 void Pager::ReadPage(uint32_t fd, uint32_t pageNum, void* dest){
-    off_t offset = (off_t)pageNum * PAGE_SIZE;
-    lseek(fd, offset, SEEK_SET);
-    read(fd, dest, PAGE_SIZE);
+    if(!BufferPool::GetInstance().io->Read(fd, (uint64_t)pageNum * PAGE_SIZE, dest, PAGE_SIZE)){
+        cerr << "Error: Failed to read page " << pageNum << " of " << fileName << endl;
+        exit(1);
+    }
+}
+
+void Pager::MarkDirty(uint32_t pageNum){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+    pool.MarkDirty(fileId, pageNum);
 }
 
-uint16_t Pager::EvictClock() {
+void* Pager::GetPage(uint32_t pageNum, bool markDirty){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+
+    if(pageNum > numPages){
+        cerr << "Error: Tried to fetch page number out of bounds." << endl;
+        return nullptr;
+    }
 
-    if(pageTable.size() < MAX_PAGES){
-        for(uint16_t i=0; i<MAX_PAGES; i++){
-            if(!(buffers[i].flags & VALID)) return i;
+    if(!markDirty){
+        void* mapped = MappedPage(pageNum);
+        if(mapped){
+            stats.hits++;
+            return mapped;
         }
     }
 
-    while(true){
-        PageBuffer& b = buffers[clockHand];
+    return pool.GetPage(fileId, pageNum, markDirty);
+}
 
-        if(b.flags & RECENT){
-            //if is recent, gives second chance
-            b.flags ^= RECENT;
-            if(++clockHand == MAX_PAGES) clockHand = 0; // advance clock
-        } 
-        else{
-            pageTable.erase(b.pageNum);
-            
-            if(b.flags & DIRTY){
-                WritePage(tempFileDescriptor, b.pageNum, b.data);
-                pagesInTemp.insert(b.pageNum);
-            }
-            
-            uint16_t id = clockHand;
-            if(++clockHand == MAX_PAGES) clockHand = 0;
+void* Pager::PinPage(uint32_t pageNum, bool markDirty){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
 
-            return id;
-        }
+    if(pageNum > numPages){
+        cerr << "Error: Tried to fetch page number out of bounds." << endl;
+        return nullptr;
     }
-}
 
-void Pager::MarkDirty(uint32_t pageNum){
-    if(pageTable.find(pageNum)!=pageTable.end()){
-        uint16_t bufferId = pageTable[pageNum];
-        buffers[bufferId].flags |= DIRTY;
+    if(!markDirty){
+        // the mapping is never evicted, so a mapped page needs no pin
+        void* mapped = MappedPage(pageNum);
+        if(mapped){
+            stats.hits++;
+            return mapped;
+        }
     }
 
+    return pool.PinPage(fileId, pageNum, markDirty);
 }
 
-void* Pager::GetPage(uint32_t pageNum, bool markDirty){
+// A mapped page is the image of the last checkpoint, while B+ tree writers change the
+// pool's frame: a reader validating node versions must read the same copy they write.
+void* Pager::PinFrame(uint32_t pageNum){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+
     if(pageNum > numPages){
         cerr << "Error: Tried to fetch page number out of bounds." << endl;
         return nullptr;
     }
+    return pool.PinPage(fileId, pageNum, 0);
+}
 
-    if(pageTable.find(pageNum) != pageTable.end()){
-        uint16_t bufferId = pageTable[pageNum];
-        PageBuffer &b = buffers[bufferId];
-        b.flags |= RECENT; 
-        if(markDirty) b.flags |= DIRTY;
-        return b.data;
-    }
+void Pager::UnpinPage(uint32_t pageNum){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+    pool.UnpinPage(fileId, pageNum);
+}
 
-    uint16_t victimId = EvictClock();
+bool Pager::IsMapped(const void* page){
+    return mapping && page >= mapping && (const char*)page < mapping + mappedLength;
+}
 
-    PageBuffer &b = buffers[victimId];
+bool Pager::LoadPage(uint32_t pageNum, void* dest){
+    auto it = walPages.find(pageNum);
+    if(it != walPages.end()){
+        IoTimer timer(stats.ioNanos);
+        BufferPool::GetInstance().wal->ReadPage(it->second, dest);
+        stats.pagesRead++;
+        return false;
+    }
 
-    void* dest = b.data;
-    
-    b.pageNum = pageNum;
-    b.flags = VALID | RECENT;
-    if(markDirty) b.flags |= DIRTY;
-    
-    pageTable[pageNum] = victimId;
+    if((uint64_t)pageNum * PAGE_SIZE < fileLength) ReadAhead(pageNum);
 
-    if(pagesInTemp.find(pageNum) != pagesInTemp.end()){
-        ReadPage(tempFileDescriptor, pageNum, dest);
-        b.flags |= DIRTY;
+    if((uint64_t)pageNum * PAGE_SIZE < mappedLength){
+        IoTimer timer(stats.ioNanos); // page faults
+        memcpy(dest, mapping + (uint64_t)pageNum * PAGE_SIZE, PAGE_SIZE);
+        stats.pagesRead++;
+        return false;
     }
-    else if(pageNum < numPages){
+
+    if((uint64_t)pageNum * PAGE_SIZE < fileLength){
+        IoTimer timer(stats.ioNanos);
         ReadPage(fileDescriptor, pageNum, dest);
-    } 
-    else{
-        memset(dest, 0, PAGE_SIZE);
-        numPages = max(numPages, pageNum + 1);
-        b.flags |= DIRTY;
+        stats.pagesRead++;
+        return false;
     }
 
+    memset(dest, 0, PAGE_SIZE);
+    numPages = max(numPages, pageNum + 1);
+    return true;
+}
 
-    return dest;
+void Pager::LogPage(uint32_t pageNum, void* data){
+    walPages[pageNum] = BufferPool::GetInstance().wal->AppendPage(fileName, pageNum, data);
 }
 
 
+void Pager::LogDirtyPages(){
+    if(dirtyPages.empty()) return;
+
+    BufferPool& pool = BufferPool::GetInstance();
+    sort(dirtyPages.begin(), dirtyPages.end());
+    dirtyPages.erase(unique(dirtyPages.begin(), dirtyPages.end()), dirtyPages.end());
+
+    for(uint32_t pageNum : dirtyPages){
+        uint32_t id = pool.pageTable.Find(BufferPool::FrameKey(fileId, pageNum));
+        if(id == NO_FRAME) continue; // evicted, its image is already logged
+
+        PageBuffer& b = pool.buffers[id];
+        if(!(b.flags & DIRTY)) continue;
+        LogPage(pageNum, b.data);
+        b.flags &= ~DIRTY;
+    }
+    dirtyPages.clear();
+}
+
 void Pager::FlushAll(){
-    void* copyBuf = malloc(PAGE_SIZE);
+    if(walPages.empty()) return;
+
+    BufferPool& pool = BufferPool::GetInstance();
 
-    for(uint32_t pageNum : pagesInTemp){
-        if(pageTable.find(pageNum) == pageTable.end()){
-            ReadPage(tempFileDescriptor, pageNum, copyBuf);
-            WritePage(fileDescriptor, pageNum, copyBuf);
+    // write in file order, one vectored write per run of adjacent pages
+    vector<uint32_t> pages;
+    pages.reserve(walPages.size());
+    for(auto const& [pageNum, offset] : walPages) pages.push_back(pageNum);
+    sort(pages.begin(), pages.end());
+
+    char* copies = (char*)AlignedAlloc((uint64_t)FLUSH_BATCH_PAGES * PAGE_SIZE); // page aligned for direct I/O
+    vector<iovec> iovs;
+    iovs.reserve(FLUSH_BATCH_PAGES); // never reallocates, requests point into it
+    vector<IoRequest> batch;
+    uint32_t copied = 0;
+
+    IoTimer timer(stats.ioNanos);
+
+    auto submitBatch = [&](){
+        pool.io->Submit(batch);
+        if(!pool.io->WaitAll()){
+            cerr << "Error: Failed to checkpoint " << fileName << endl;
+            exit(1);
+        }
+        batch.clear();
+        iovs.clear();
+        copied = 0;
+    };
+
+    for(uint32_t i = 0; i < pages.size(); i++){
+        uint32_t pageNum = pages[i];
+
+        void* src;
+        uint32_t id = pool.pageTable.Find(BufferPool::FrameKey(fileId, pageNum));
+        if(id != NO_FRAME && !(pool.buffers[id].flags & DIRTY)){
+            // the cached copy is exactly what was logged
+            src = pool.buffers[id].data;
+        }
+        else{
+            src = copies + (uint64_t)copied++ * PAGE_SIZE;
+            pool.wal->ReadPage(walPages[pageNum], src);
         }
+
+        iovs.push_back({src, PAGE_SIZE});
+        if(!batch.empty() && i > 0 && pages[i - 1] + 1 == pageNum){
+            batch.back().iovCount++;
+            batch.back().length += PAGE_SIZE;
+        }
+        else{
+            batch.push_back({(int)fileDescriptor, (uint64_t)pageNum * PAGE_SIZE, nullptr, PAGE_SIZE, true, &iovs.back(), 1});
+        }
+        fileLength = max<uint64_t>(fileLength, (uint64_t)(pageNum + 1) * PAGE_SIZE);
+
+        if(iovs.size() == FLUSH_BATCH_PAGES) submitBatch();
     }
-    free(copyBuf);
+    if(!batch.empty()) submitBatch();
+    AlignedFree(copies);
 
-    for(PageBuffer& b : buffers) if((b.flags & VALID) && (b.flags & DIRTY)){
-        WritePage(fileDescriptor, b.pageNum, b.data);
-        b.flags &= ~DIRTY;
+    SyncFile(fileDescriptor);
+    stats.pagesWritten += pages.size();
+    stats.bytesSynced += (uint64_t)pages.size() * PAGE_SIZE;
+
+    walPages.clear();
+
+    if(pool.mmapFiles && fileLength > mappedLength) Map(); // the file grew, extend the mapping
+}
+
+
+void Pager::Prefetch(uint32_t firstPage, uint32_t count){
+    uint64_t offset = (uint64_t)firstPage * PAGE_SIZE;
+    if(offset >= fileLength || count == 0 || directIo) return; // nothing to warm with direct I/O
+    uint64_t length = min<uint64_t>((uint64_t)count * PAGE_SIZE, fileLength - offset);
+
+    if(offset + length <= mappedLength) PrefetchMapping(mapping, offset, length);
+    else PrefetchFile(fileDescriptor, offset, length);
+}
+
+void Pager::Prefetch(vector<uint32_t>& pages){
+    sort(pages.begin(), pages.end());
+
+    uint32_t i = 0;
+    while(i < pages.size()){
+        uint32_t j = i + 1;
+        while(j < pages.size() && pages[j] == pages[j - 1] + 1) j++;
+        Prefetch(pages[i], j - i);
+        i = j;
     }
+}
 
-    #ifdef _WIN32
-        _commit(fileDescriptor);
-    #else
-        fsync(fileDescriptor);
-    #endif
+void Pager::ReadPages(const uint32_t* pages, uint32_t count){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+
+    // a frame stays pinned while its read is in flight, so a batch never recycles its own
+    uint32_t limit = min(READ_BATCH_PAGES, pool.SCAN_RING_LIMIT);
+    vector<uint32_t> frames;
+    vector<iovec> iovs;
+    iovs.reserve(limit); // never reallocates, requests point into it
+    vector<IoRequest> batch;
+    uint32_t last = UINT32_MAX - 1;
+
+    auto submitBatch = [&](){
+        {
+            IoTimer timer(stats.ioNanos);
+            pool.io->Submit(batch);
+            if(!pool.io->WaitAll()){
+                cerr << "Error: Failed to read pages of " << fileName << endl;
+                exit(1);
+            }
+        }
+        for(uint32_t id : frames) pool.buffers[id].pinCount--;
+        frames.clear();
+        batch.clear();
+        iovs.clear();
+    };
+
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t pageNum = pages[i];
+        uint64_t offset = (uint64_t)pageNum * PAGE_SIZE;
+
+        // logged, mapped and new pages are left to LoadPage, so are the cached ones
+        if(offset >= fileLength || offset < mappedLength || walPages.find(pageNum) != walPages.end()) continue;
+        if(pool.pageTable.Find(BufferPool::FrameKey(fileId, pageNum)) != NO_FRAME) continue;
+
+        uint32_t id = pool.NewFrame(fileId, pageNum);
+        PageBuffer& b = pool.buffers[id];
+        b.pinCount++;
+        frames.push_back(id);
+        stats.misses++;
+        stats.pagesRead++;
+
+        // one vectored read per run of adjacent pages, as FlushAll writes them
+        iovs.push_back({b.data, PAGE_SIZE});
+        if(!batch.empty() && last + 1 == pageNum){
+            batch.back().iovCount++;
+            batch.back().length += PAGE_SIZE;
+        }
+        else{
+            batch.push_back({(int)fileDescriptor, offset, nullptr, PAGE_SIZE, false, &iovs.back(), 1});
+        }
+        last = pageNum;
 
-    #ifdef _WIN32
-        _chsize(tempFileDescriptor, 0); 
-    #else
-        ftruncate(tempFileDescriptor, 0);
-    #endif
-    
-    pagesInTemp.clear();
+        if(frames.size() == limit) submitBatch();
+    }
+    if(!batch.empty()) submitBatch();
 }
 
+void Pager::ReadAhead(uint32_t pageNum){
+    bool sequential = pageNum == lastMiss + 1;
+    lastMiss = pageNum;
 
+    if(pageNum >= readAheadStart && pageNum < readAheadEnd){
+        // inside the hinted window: slide it once the reader is halfway through
+        if(readAheadEnd - pageNum > READ_AHEAD_PAGES / 2) return;
+        Prefetch(readAheadEnd, pageNum + 1 + READ_AHEAD_PAGES - readAheadEnd);
+        readAheadEnd = pageNum + 1 + READ_AHEAD_PAGES;
+        return;
+    }
 
+    // a new stream: two misses in a row, or anything inside a full scan
+    if(!sequential && scanDepth == 0) return;
+    Prefetch(pageNum + 1, READ_AHEAD_PAGES);
+    readAheadStart = pageNum;
+    readAheadEnd = pageNum + 1 + READ_AHEAD_PAGES;
+}
+
+ScanGuard::ScanGuard(Pager* pager)
+    : pager(pager)
+{
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+    pool.BeginScan(pager);
+}
+
+ScanGuard::~ScanGuard(){
+    BufferPool& pool = BufferPool::GetInstance();
+    lock_guard<mutex> lock(pool.mtx);
+    pool.EndScan(pager);
+}
@@ -2,63 +2,99 @@
 
 #pragma once
 
+#include "BufferPool.h"
+#include "Stats.h"
+
 #include <string>
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
-#include <unordered_set>
-#include <bitset> 
-#include <list>
 
 using namespace std;
 
 
-#define PAGE_SIZE 4096
-const uint32_t DEFAULT_CACHE_LIMIT = 50000; //50k page ~200MB
-
-enum PageBufferFlags : uint8_t {
-    VALID = 1,
-    DIRTY = 2,
-    RECENT = 4
-};
-
-struct PageBuffer{
-    void* data;          
-    uint32_t pageNum;    
-    uint8_t flags; 
-};
-
+// A Pager owns one file on disk. Its pages are cached in the shared BufferPool.
 class Pager {
 public:
-    Pager(const string& filename, uint32_t maxPages = DEFAULT_CACHE_LIMIT);
+    Pager(const string& filename);
     ~Pager();
 
     
     // Core I/O Helpers
     void WritePage(uint32_t fd, uint32_t pageNum, void* data);
     void ReadPage(uint32_t fd, uint32_t pageNum, void* dest);
+
+    inline static constexpr uint32_t FLUSH_BATCH_PAGES = 256; // pages in flight per checkpoint batch
+    inline static constexpr uint32_t READ_AHEAD_PAGES = 64; // window hinted ahead of a sequential reader
+    inline static constexpr uint32_t READ_BATCH_PAGES = 32; // pages in flight per ReadPages batch, at most the scan ring
     
     // Management
-    void* GetPage(uint32_t pageNum, bool markDirty);
+    void* GetPage(uint32_t pageNum, bool markDirty); // clean reads may point into the mapping
+    void* MappedPage(uint32_t pageNum); // nullptr unless the mapping holds the latest image
+    void* PinPage(uint32_t pageNum, bool markDirty); // like GetPage, but stays cached until UnpinPage
+    void* PinFrame(uint32_t pageNum); // PinPage that never returns the mapping, see Btree latches
+    void UnpinPage(uint32_t pageNum);
+    bool IsMapped(const void* page); // PinPage handed out the mapping, which takes no pin to release
     void MarkDirty(uint32_t pageNum);
-    uint16_t EvictClock();
-    void FlushAll(); // COMMIT
+    void FlushAll(); // CHECKPOINT: copy this file's logged pages into it
+
+    // Read-ahead hints, they only warm the OS cache and never block
+    void Prefetch(uint32_t firstPage, uint32_t count);
+    void Prefetch(vector<uint32_t>& pages); // any order, adjacent pages are hinted as one range
+    void ReadAhead(uint32_t pageNum); // called on every miss, follows sequential readers
+
+    // Reads the listed pages that are not cached yet into the pool in one batch, so the
+    // backend keeps them in flight together; range scans call it ahead of each run
+    void ReadPages(const uint32_t* pages, uint32_t count);
+
+    // Called by the BufferPool
+    bool LoadPage(uint32_t pageNum, void* dest); // returns true if the loaded page must be treated as dirty
+    void LogPage(uint32_t pageNum, void* data);
+    void LogDirtyPages(); // COMMIT: log every page still dirty in the pool, in page order
+
+    // mmap mode
+    void Map(); // (re)maps the whole file, called on open and when a checkpoint grows it
+    void Unmap();
 
     
 public:
     string fileName;
+    uint16_t fileId;
 
-
-
-    uint32_t MAX_PAGES;
-    vector<PageBuffer> buffers;
-    unordered_map<uint32_t, uint16_t> pageTable; // maps pageId -> index in buffers
-    unordered_set<uint32_t> pagesInTemp;
-    uint16_t clockHand; 
+    unordered_map<uint32_t, uint64_t> walPages; // pages whose latest image is in the WAL -> its offset
+    vector<uint32_t> dirtyPages; // pages dirtied since the last commit, may repeat or already be evicted
 
     uint32_t fileDescriptor;
-    uint32_t tempFileDescriptor;
+    bool directIo; // opened with O_DIRECT, every transfer must be page aligned
 
     uint32_t numPages;
-    uint32_t fileLength;
-};
\ No newline at end of file
+    uint64_t fileLength;
+
+    PagerStats stats;
+
+    // read-only, never written through: changes go to pool frames and the WAL,
+    // and reach the mapping when a checkpoint writes them to the file
+    char* mapping;
+    uint64_t mappedLength;
+
+    // full scans, see ScanGuard
+    uint32_t scanDepth;
+    vector<uint32_t> scanRing;
+    uint32_t scanHand;
+
+    // sequential miss detection
+    uint32_t lastMiss;
+    uint32_t readAheadStart; // window already hinted: [readAheadStart, readAheadEnd)
+    uint32_t readAheadEnd;
+};
+
+// Marks a full pass over one file. While alive, pages the scan misses on cycle
+// through a small ring of frames instead of pushing other pages out of the pool.
+class ScanGuard {
+public:
+    ScanGuard(Pager* pager);
+    ~ScanGuard();
+
+private:
+    Pager* pager;
+};
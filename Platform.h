@@ -0,0 +1,94 @@
+// Platform.h
+
+#pragma once
+
+#include <fcntl.h>   // open flags
+#include <sys/stat.h> // fstat
+#include <cstdint>
+#include <cstdlib> // posix_memalign, free
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <malloc.h> // _aligned_malloc
+    #define S_IWUSR S_IWRITE
+    #define S_IRUSR S_IREAD
+    #define open _open
+    #define close _close
+    #define read _read
+    #define write _write
+    #define lseek _lseek
+    #define chsize _chsize // For truncating
+    #include <cstddef>
+    using ssize_t = ptrdiff_t;
+#else
+    #include <unistd.h>
+    #include <sys/mman.h> // mmap
+    #define O_BINARY 0
+#endif
+
+// Opens a file so reads and writes bypass the OS page cache, -1 if the platform or file system can't
+inline int OpenDirect(const char* path){
+    #if defined(O_DIRECT)
+        return open(path, O_RDWR | O_CREAT | O_BINARY | O_DIRECT, S_IWUSR | S_IRUSR);
+    #elif defined(__APPLE__)
+        int fd = open(path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+        if(fd != -1) fcntl(fd, F_NOCACHE, 1);
+        return fd;
+    #else
+        (void)path;
+        return -1;
+    #endif
+}
+
+// Page-aligned heap memory, as O_DIRECT transfers need
+inline void* AlignedAlloc(uint64_t bytes){
+    #ifdef _WIN32
+        return _aligned_malloc(bytes, 4096);
+    #else
+        void* p = nullptr;
+        return posix_memalign(&p, 4096, bytes) == 0 ? p : nullptr;
+    #endif
+}
+
+inline void AlignedFree(void* p){
+    #ifdef _WIN32
+        _aligned_free(p);
+    #else
+        free(p);
+    #endif
+}
+
+inline void SyncFile(int fd){
+    #ifdef _WIN32
+        _commit(fd);
+    #else
+        fsync(fd);
+    #endif
+}
+
+// Asks the OS to start reading a byte range into its cache, returns immediately
+inline void PrefetchFile(int fd, uint64_t offset, uint64_t length){
+    #if defined(__linux__)
+        posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+    #elif defined(__APPLE__)
+        struct radvisory ra = { (off_t)offset, (int)length };
+        fcntl(fd, F_RDADVISE, &ra);
+    #endif
+}
+
+// Same for part of a mapping starting at base
+inline void PrefetchMapping(char* base, uint64_t offset, uint64_t length){
+    #ifndef _WIN32
+        uint64_t align = sysconf(_SC_PAGESIZE);
+        uint64_t start = offset / align * align;
+        madvise(base + start, length + offset - start, MADV_WILLNEED);
+    #endif
+}
+
+inline void TruncateFile(int fd, off_t length){
+    #ifdef _WIN32
+        _chsize(fd, length);
+    #else
+        ftruncate(fd, length);
+    #endif
+}
@@ -3,6 +3,9 @@
 #include "Schema.h"
 #include "Btree.h"  // Needed for CreateIndex logic
 #include "Pager.h"  // Needed for Pager methods
+#include "FixedKey.h"
+#include "PageScan.h"
+#include "MorselScan.h"
 
 #include <cstring>
 #include <iostream>
@@ -15,17 +18,245 @@ Column::Column(const string &name, Type type, uint32_t size, uint32_t offset)
 
 Column::~Column(){}
 
-Row::Row(const vector<Column*> &schema){
-    for(Column* c : schema){
-        if(c->type == INT) value[c->columnName] = malloc(sizeof(int32_t));
-        else value[c->columnName] = malloc(c->size);
-    }
-}   
+Row::Row() : table(nullptr), data(nullptr), owned(0) {}
+
+Row::Row(Table* t) : table(t), data((char*)calloc(1, t->rowSize)), owned(1) {}
+
+Row::Row(Table* t, char* data) : table(t), data(data), owned(0) {}
 
 Row::~Row(){
-    for(auto &p : value) free(p.second);
+    if(owned) free(data);
+}
+
+void* Row::Value(const string& columnName) const {
+    return Value(table->colPtr.at(columnName));
+}
+
+RowSet::RowSet(Table* t) : table(t), count(0) {}
+
+void RowSet::Add(const void* slot){
+    arena.insert(arena.end(), (const char*)slot, (const char*)slot + table->rowSize);
+    count++;
+}
+
+Row RowSet::Append(){
+    arena.resize(arena.size() + table->rowSize);
+    count++;
+    return Row(table, arena.data() + (count - 1) * table->rowSize);
+}
+
+void RowSet::Clear(){
+    arena.clear();
+    count = 0;
+}
+
+Row RowSet::operator[](size_t i){
+    return Row(table, arena.data() + i * table->rowSize);
+}
+
+RowCursor::RowCursor(Table* t)
+    : table(t), batchPos(0), batchSize(0), page(nullptr), pageNum(0) {}
+
+RowCursor::~RowCursor(){
+    ReleasePage();
+}
+
+uint64_t RowCursor::Count(){
+    uint64_t count = 0;
+    while(uint32_t n = NextBatch(batch, BATCH_ROWS)) count += n;
+    return count;
+}
+
+void RowCursor::ReleasePage(){
+    if(page && !table->pager->IsMapped(page)) table->pager->UnpinPage(pageNum);
+    page = nullptr;
+}
+
+bool RowCursor::Next(Row& view){
+    if(batchPos == batchSize){
+        batchSize = NextBatch(batch, BATCH_ROWS);
+        batchPos = 0;
+        if(batchSize == 0) return false;
+    }
+    // the page stays pinned while the view is in use: a parallel scan's workers
+    // load pages concurrently and could otherwise evict it
+    uint32_t rowId = batch[batchPos++];
+    if(!page || rowId / table->rowsPerPage != pageNum){
+        ReleasePage();
+        pageNum = rowId / table->rowsPerPage;
+        page = (char*)table->pager->PinPage(pageNum, 0);
+    }
+    view.table = table;
+    view.data = page + rowId % table->rowsPerPage * table->rowSize;
+    return true;
 }
 
+// The index's range, in key order.
+class IndexCursor : public RowCursor{
+public:
+    IndexCursor(Table* t, BtreeCursor* range) : RowCursor(t), range(range) {}
+    ~IndexCursor() { delete range; }
+
+    uint32_t NextBatch(uint32_t* outRowIds, uint32_t max) override {
+        return range->Next(outRowIds, max);
+    }
+
+private:
+    BtreeCursor* range;
+};
+
+// Every live row, in rowId order. The cursor is one full pass over the heap, see ScanGuard.
+// Each page is read once: the filter marks the slots to hand out in a bitmask, and
+// NextBatch then walks its set bits, so the pager is not asked again for every row.
+// A table of several morsels is filtered by the WorkerPool instead, see MorselScan.
+class ScanCursor : public RowCursor{
+public:
+    ScanCursor(Table* t) : RowCursor(t), scan(t->pager), started(0), pageFirst(0), pageRows(0), pos(0), readEnd(0) {}
+    ~ScanCursor() { if(morsels) morsels->Stop(); }
+
+    uint32_t NextBatch(uint32_t* outRowIds, uint32_t max) override {
+        if(!started) Start(false);
+        if(morsels) return NextMorselBatch(outRowIds, max);
+
+        uint32_t count = 0;
+        while(count < max){
+            if(pos == pageRows && !NextPage()) break;
+
+            uint64_t bits = mask[pos / 64] >> (pos % 64);
+            if(bits == 0){
+                pos = min(pageRows, (pos / 64 + 1) * 64);
+                continue;
+            }
+            pos += __builtin_ctzll(bits);
+            outRowIds[count++] = pageFirst + pos++;
+        }
+        return count;
+    }
+
+    uint64_t Count() override {
+        if(!started) Start(true);
+        if(!morsels) return RowCursor::Count();
+
+        uint64_t count = morselRows.size() - morselPos;
+        return count + morsels->Count();
+    }
+
+protected:
+    // How a page's slots are selected, by default every live row. Workers call the
+    // filter concurrently, so it captures what it needs by value.
+    virtual PageFilter Filter() {
+        uint32_t rowSize = table->rowSize;
+        return { {}, [rowSize](const char* page, uint32_t n, uint64_t* mask){ LiveSlots(page, n, rowSize, mask); } };
+    }
+
+private:
+    void Start(bool countOnly){
+        started = 1;
+        filter = Filter();
+        uint32_t workers = MorselScan::Workers(table);
+        if(workers > 1) morsels = MorselScan::Start(table, filter, workers, countOnly);
+        morselPos = 0;
+    }
+
+    uint32_t NextMorselBatch(uint32_t* outRowIds, uint32_t max){
+        uint32_t count = 0;
+        while(count < max){
+            if(morselPos == morselRows.size()){
+                if(!morsels->Take(morselRows)) break;
+                morselPos = 0;
+                continue;
+            }
+            uint32_t n = min<size_t>(max - count, morselRows.size() - morselPos);
+            memcpy(outRowIds + count, morselRows.data() + morselPos, n * sizeof(uint32_t));
+            morselPos += n;
+            count += n;
+        }
+        return count;
+    }
+
+    // Filters the next page that may match, false once past the last row
+    bool NextPage(){
+        pageFirst += pageRows;
+        pageRows = 0;
+        while(pageFirst < table->rowCount && filter.mayMatch && !filter.mayMatch(pageFirst / table->rowsPerPage)){
+            pageFirst += table->rowsPerPage;
+        }
+        if(pageFirst >= table->rowCount) return false;
+
+        pageRows = min<uint32_t>(table->rowsPerPage, table->rowCount - pageFirst);
+        pos = 0;
+        // pinned while filtered, another scan's workers may be loading pages meanwhile
+        uint32_t pageNum = pageFirst / table->rowsPerPage;
+        if(pageNum >= readEnd) ReadRun(pageNum);
+        const char* page = (const char*)table->pager->PinPage(pageNum, 0);
+        if(!page){
+            ClearMask(mask, pageRows);
+            return true;
+        }
+        filter.select(page, pageRows, mask);
+        if(!table->pager->IsMapped(page)) table->pager->UnpinPage(pageNum);
+        return true;
+    }
+
+    // Reads the next pages that may match, from pageNum on, in one batch
+    void ReadRun(uint32_t pageNum){
+        uint32_t lastPage = (table->rowCount - 1) / table->rowsPerPage;
+        vector<uint32_t> pages;
+        for(; pageNum <= lastPage && pages.size() < Pager::READ_BATCH_PAGES; pageNum++){
+            if(!filter.mayMatch || filter.mayMatch(pageNum)) pages.push_back(pageNum);
+        }
+        table->pager->ReadPages(pages.data(), pages.size());
+        readEnd = pageNum;
+    }
+
+    ScanGuard scan;
+    PageFilter filter;
+    bool started;
+
+    // serial scan
+    uint32_t pageFirst; // rowId of the current page's first slot
+    uint32_t pageRows;  // slots of the current page below rowCount
+    uint32_t pos;       // next slot of the current page to look at
+    uint64_t mask[PAGE_SIZE / 64]; // a slot is at least a byte, so a page never has more
+    uint32_t readEnd;   // pages below it were already batch read, see ReadRun
+
+    // parallel scan
+    shared_ptr<MorselScan> morsels;
+    vector<uint32_t> morselRows; // the rowIds of the morsel being handed out
+    size_t morselPos;
+};
+
+// The live rows whose column is in [L, R], without an index.
+template <typename T>
+class RangeScanCursor : public ScanCursor{
+public:
+    RangeScanCursor(Table* t, Column* col, void* L, void* R)
+        : ScanCursor(t), col(col), valL(LoadKey<T>(L, col->size)), valR(LoadKey<T>(R, col->size)) {}
+
+protected:
+    PageFilter Filter() override {
+        uint32_t rowSize = table->rowSize, offset = col->offset, size = col->size;
+        T L = valL, R = valR;
+        PageFilter filter;
+        filter.select = [=](const char* page, uint32_t n, uint64_t* mask){
+            FilterSlots<T>(page, n, rowSize, offset, size, L, R, mask);
+        };
+
+        // int columns skip the pages whose zone misses [L, R]
+        if constexpr (is_same_v<T, int32_t>){
+            const ZoneMap* zones = &table->zones;
+            int32_t zoneCol = zones->ColumnOf(col);
+            if(zoneCol >= 0) filter.mayMatch = [=](uint32_t pageNum){ return zones->MayMatch(zoneCol, pageNum, L, R); };
+        }
+        return filter;
+    }
+
+private:
+    Column* col;
+    T valL;
+    T valR;
+};
+
 Table::Table(const string &name, const string &meta) 
     : tableName(name), rowCount(0), rowSize(ROW_HEADER_SIZE), rowsPerPage(0), metaName(meta), pager(new Pager(meta+"_"+name+".db"))
 {}
@@ -47,48 +278,42 @@ Table::~Table(){
 }
 
 Row* Table::ParseRow(stringstream &ss){
+    Row* r = new Row(this);
+    ParseRow(ss, *r);
+    return r;
+}
+
+void Table::ParseRow(stringstream &ss, Row& dest){
     string str;
     int32_t num;
 
-    Row* r = new Row(schema);
     for(Column* c : schema){
         if(c->type == INT){
             ss >> num;
-            *(int32_t*)(r->value[c->columnName]) = num;
+            *(int32_t*)dest.Value(c) = num;
         }
         else{
             ss >> quoted(str);
             uint32_t len = min((uint32_t)str.size(), c->size-1);
-            void* dest = r->value[c->columnName];
-            memset(dest, 0, c->size);
-            memcpy(dest, &str[0], len);
+            void* value = dest.Value(c);
+            memset(value, 0, c->size);
+            memcpy(value, &str[0], len);
         }
     }
-    return r;
 }
 
+// Rows are laid out as their slots, a row is copied whole.
 void Table::SerializeRow(Row* src, void* dest){
     if(src == nullptr || dest == nullptr) return;
 
-    uint8_t isDeleted = 0;
-    memcpy(dest, &isDeleted, sizeof(uint8_t));
-    
-
-    for(Column* c : schema){
-        memset((char*)dest+c->offset, 0, c->size);
-        memcpy((char*)dest+c->offset, src->value[c->columnName], c->size);
-        
-    }
+    memcpy(dest, src->data, rowSize);
+    *(uint8_t*)dest = 0; // live
 }
 
 void Table::DeserializeRow(void* src, Row* dest){
     if(src == nullptr || dest == nullptr) return;
-    
 
-    for(Column* c : schema){
-        memcpy(dest->value[c->columnName], (char*)src+c->offset, c->size);
-        
-    }
+    memcpy(dest->data, src, rowSize);
 }
 
 void Table::AddColumn(Column* c){
@@ -96,6 +321,7 @@ void Table::AddColumn(Column* c){
     rowSize += c->size;
     rowsPerPage = PAGE_SIZE / rowSize; 
     colPtr[c->columnName] = c;
+    zones.AddColumn(c);
 }
 
 void* Table::RowSlot(uint32_t rowId, bool markDirty){
@@ -118,16 +344,10 @@ void Table::CreateIndex(const string& columnName){
 
     Column* col = colPtr[columnName];
 
-    string indexFileName = metaName + "_" + tableName + "_" + columnName + ".btree";
-    Pager* p = new Pager(indexFileName);
+    Pager* p = new Pager(IndexFileName(columnName));
 
 
-    BtreeIndex* tree = nullptr;
-
-    switch(col->type){
-        case INT: tree = new Btree<int32_t>(p, this); break;
-        // other cases
-    }
+    BtreeIndex* tree = NewIndex(col, p);
 
 
     if(p->numPages == 0){
@@ -136,6 +356,72 @@ void Table::CreateIndex(const string& columnName){
     colIdx[columnName] = tree;
 }
 
+Result Table::BuildIndex(const string& columnName){
+    if(colPtr.find(columnName)==colPtr.end()){
+        cout << "Error: Column '" << columnName << "' not found." << endl;
+        return Result::ERROR;
+    }
+    if(colIdx.find(columnName)!=colIdx.end()){
+        cout << "Error: Column '" << columnName << "' is already indexed." << endl;
+        return Result::ERROR;
+    }
+
+    Column* col = colPtr[columnName];
+    if(col->type == STRING && col->size > MAX_KEY_SIZE){
+        cout << "Error: Only char columns of up to " << MAX_KEY_SIZE << " bytes can be indexed." << endl;
+        return Result::INVALID_SCHEMA;
+    }
+
+    // leftovers of an index that was built but never committed
+    string indexFileName = IndexFileName(columnName);
+    BufferPool::GetInstance().RemoveFile(indexFileName);
+
+    BtreeIndex* tree = NewIndex(col, new Pager(indexFileName));
+    tree->BulkLoad(col->offset);
+    colIdx[columnName] = tree;
+    return Result::OK;
+}
+
+string Table::IndexFileName(const string& columnName){
+    return metaName + "_" + tableName + "_" + columnName + ".btree";
+}
+
+string Table::ZoneFileName(){
+    return metaName + "_" + tableName + ".zone";
+}
+
+void Table::SaveZones(){
+    zones.Save(ZoneFileName(), rowCount);
+}
+
+void Table::LoadZones(){
+    if(zones.Columns() == 0) return;
+    uint32_t pages = (rowCount + rowsPerPage - 1) / rowsPerPage;
+    if(zones.Load(ZoneFileName(), rowCount, pages)) return;
+
+    // no file yet, or not the one of the catalog's commit: one pass over the live rows
+    ScanGuard scan(pager);
+    for(uint32_t pageNum = 0; pageNum < pages; pageNum++){
+        const char* page = (const char*)RowSlot(pageNum * rowsPerPage, 0);
+        if(!page) continue;
+        uint32_t n = min<uint32_t>(rowsPerPage, rowCount - pageNum * rowsPerPage);
+        for(uint32_t i = 0; i < n; i++){
+            if(page[i * rowSize] != 1) zones.Widen(pageNum, page + i * rowSize);
+        }
+    }
+}
+
+BtreeIndex* Table::NewIndex(Column* col, Pager* p){
+    switch(col->type){
+        case INT: return new Btree<int32_t>(p, this);
+        case STRING: return VisitFixedKey(col->size, [&](auto key) -> BtreeIndex* {
+            return new Btree<decltype(key)>(p, this, col->size);
+        });
+        default: break;
+    }
+    return nullptr;
+}
+
 bool Table::IsRowDeleted(uint32_t rowId){
     void* slot = RowSlot(rowId, 0);
     if (!slot) return true;
@@ -143,16 +429,38 @@ bool Table::IsRowDeleted(uint32_t rowId){
     return (flag == 1);
 }
 
+// The page is pinned while the flag is written: a parallel scan's workers load pages
+// concurrently and could otherwise reuse its frame in between, see MorselScan.
 void Table::MarkRowDeleted(uint32_t rowId){
-    void* slot = RowSlot(rowId, 1);
-    if (!slot) return;
+    uint32_t pageNum = rowId / rowsPerPage;
+    char* page = (char*)pager->PinPage(pageNum, 1); // a dirty page is never the mapping
+    if (!page) return;
 
     uint8_t flag = 1; // 1 = Dead
-    memcpy(slot, &flag, sizeof(uint8_t));
+    memcpy(page + rowId % rowsPerPage * rowSize, &flag, sizeof(uint8_t));
+    pager->UnpinPage(pageNum);
 
     freeList.push_back(rowId);
 }
 
+void Table::DeleteRow(uint32_t rowId){
+    if(!colIdx.empty()){
+        // copy the keys out, the slot can be evicted while the trees change;
+        // pinned for the copy, for the same reason as in MarkRowDeleted
+        vector<char> row(rowSize);
+        uint32_t pageNum = rowId / rowsPerPage;
+        char* page = (char*)pager->PinPage(pageNum, 0);
+        memcpy(row.data(), page + rowId % rowsPerPage * rowSize, rowSize);
+        if(!pager->IsMapped(page)) pager->UnpinPage(pageNum);
+
+        for(auto const& [colName, tree] : colIdx){
+            tree->Delete(row.data() + colPtr[colName]->offset, rowId);
+        }
+    }
+
+    MarkRowDeleted(rowId);
+}
+
 uint32_t Table::GetNextRowId(){
     if(!freeList.empty()){
         uint32_t id = freeList.back();
@@ -167,91 +475,105 @@ void Table::Insert(Row* r){
     
     for(Column* c : schema){
         if(colIdx.find(c->columnName) != colIdx.end()){
-            colIdx[c->columnName]->Insert(r->value[c->columnName], newRowId);
+            colIdx[c->columnName]->Insert(r->Value(c), newRowId);
         }
     }
 
 
     SerializeRow(r, RowSlot(newRowId, 1));
+    zones.Widen(newRowId / rowsPerPage, r->data);
 }
 
-void Table::SelectRange(const string& colName, void* L, void* R, vector<uint32_t>& out){
-    // if has index
-    if(colIdx.find(colName) != colIdx.end()){
-        BtreeIndex* tree = colIdx[colName];
-        tree->SelectRange(L, R, out);
-        return;
+void Table::InsertBatch(RowSet& rows){
+    vector<uint32_t> rowIds(rows.size());
+    for(size_t i = 0; i < rows.size(); i++){
+        Row r = rows[i];
+        rowIds[i] = GetNextRowId();
+        SerializeRow(&r, RowSlot(rowIds[i], 1));
+        zones.Widen(rowIds[i] / rowsPerPage, r.data);
     }
 
-    if(colPtr.find(colName) == colPtr.end()){
-        cout << "Error: Column " << colName << " not found." << endl;
-        return;
+    for(auto const& [colName, tree] : colIdx){
+        Column* col = colPtr[colName];
+        vector<char> keys(rows.size() * col->size);
+        for(size_t i = 0; i < rows.size(); i++) memcpy(keys.data() + i * col->size, rows[i].Value(col), col->size);
+        tree->InsertBatch(keys.data(), rowIds.data(), rows.size());
     }
+}
 
-    Column* col = colPtr[colName];
-    switch(col->type){
-        case INT: SelectScan<int32_t>(col, L, R, out); break;
-        // other cases
-    }
+RowCursor* Table::OpenScan(){
+    return new ScanCursor(this);
 }
 
-uint32_t Table::DeleteRange(const string& colName, void* L, void* R){
+RowCursor* Table::OpenRange(const string& colName, void* L, void* R){
     // if has index
     if(colIdx.find(colName) != colIdx.end()){
-        BtreeIndex* tree = colIdx[colName];
-        return tree->DeleteRange(L, R);;
+        return new IndexCursor(this, colIdx[colName]->OpenRange(L, R));
     }
 
     if(colPtr.find(colName) == colPtr.end()){
         cout << "Error: Column " << colName << " not found." << endl;
-        return 0;
+        return nullptr;
     }
 
     Column* col = colPtr[colName];
     switch(col->type){
-        case INT: return DeleteScan<int32_t>(col, L, R);
-        // other cases
+        case INT: return new RangeScanCursor<int32_t>(this, col, L, R);
+        case STRING: return VisitFixedKey(col->size, [&](auto key) -> RowCursor* { return new RangeScanCursor<decltype(key)>(this, col, L, R); });
+        default: break;
     }
+    return nullptr;
+}
+
+void Table::SelectRange(const string& colName, void* L, void* R, vector<uint32_t>& out){
+    RowCursor* cursor = OpenRange(colName, L, R);
+    if(!cursor) return;
 
-    return 0;
+    uint32_t rowIds[RowCursor::BATCH_ROWS];
+    while(uint32_t n = cursor->NextBatch(rowIds, RowCursor::BATCH_ROWS)) out.insert(out.end(), rowIds, rowIds + n);
+    delete cursor;
 }
 
-template <typename T>
-void Table::SelectScan(Column* col, void* L, void* R, vector<uint32_t>& out){
-    T valL = *(T*) L;
-    T valR = *(T*) R;
+uint32_t Table::CountRange(const string& colName, void* L, void* R){
+    // if has index, only its leaves are read
+    if(colIdx.find(colName) != colIdx.end()){
+        return colIdx[colName]->CountRange(L, R);
+    }
 
-    for(uint32_t i = 0; i < rowCount; i++){
-        if(IsRowDeleted(i)) continue;
+    RowCursor* cursor = OpenRange(colName, L, R);
+    if(!cursor) return 0;
 
-        void* slot = RowSlot(i, 0);
-        void* colData = (char*)slot + col->offset;
-        T key = *(T*) colData;
+    uint32_t count = cursor->Count();
+    delete cursor;
+    return count;
+}
 
-        if(valL <= key && key <= valR){
-            out.push_back(i);
-        }
-    }
+uint32_t Table::LiveRows(){
+    return rowCount - freeList.size();
 }
 
-template <typename T>
-uint32_t Table::DeleteScan(Column* col, void* L, void* R){
-    uint32_t deletedCount = 0;
-    T valL = *(T*) L;
-    T valR = *(T*) R;
+uint32_t Table::DeleteRange(const string& colName, void* L, void* R){
+    // if has index
+    if(colIdx.find(colName) != colIdx.end()){
+        BtreeIndex* tree = colIdx[colName];
+        return tree->DeleteRange(L, R);
+    }
 
-    for(uint32_t i = 0; i < rowCount; i++){
-        if(IsRowDeleted(i)) continue;
+    // without one the scan filters a page at a time, and the rows of each batch
+    // are deleted before the next batch is read
+    return DeleteRows(OpenRange(colName, L, R));
+}
 
-        void* slot = RowSlot(i, 0);
-        void* colData = (char*)slot + col->offset;
-        T key = *(T*) colData;
+uint32_t Table::DeleteRows(RowCursor* cursor){
+    if(!cursor) return 0;
 
-        if(valL <= key && key <= valR){
-            MarkRowDeleted(i);
-            deletedCount++;
-        }
+    uint32_t deletedCount = 0;
+    uint32_t rowIds[RowCursor::BATCH_ROWS];
+    while(uint32_t n = cursor->NextBatch(rowIds, RowCursor::BATCH_ROWS)){
+        for(uint32_t i = 0; i < n; i++) DeleteRow(rowIds[i]);
+        deletedCount += n;
     }
+    delete cursor;
     return deletedCount;
 }
 
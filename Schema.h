@@ -4,6 +4,7 @@
 
 
 #include "Common.h"
+#include "ZoneMap.h"
 #include <map>
 #include <stack>
 
@@ -25,14 +26,79 @@ public:
     uint32_t offset;
 };
 
+class Table;
+
+// A row laid out as in its heap slot: the deleted flag, then every column at its offset.
+// Either it owns its bytes, or it is a view of bytes it does not own: a slot in a page,
+// a row of a RowSet. Views cost nothing to make, and are only valid as long as those bytes.
 class Row{
 public:
-    Row();
-    Row(const vector<Column*> &schema);
+    Row(); // an empty view, see RowCursor::Next
+    Row(Table* t); // owns a zeroed row of t
+    Row(Table* t, char* data); // views data
     ~Row();
 
+    Row(const Row&) = delete;
+    Row& operator=(const Row&) = delete;
+
+    void* Value(Column* c) const { return data + c->offset; }
+    void* Value(const string& columnName) const; // by name, looked up in the table
+
+public:
+    Table* table;
+    char* data;
+    bool owned;
+};
+
+// Rows copied out of their pages, back to back in one buffer: a result that outlives
+// its cursor, or a batch of rows to insert, for one allocation per growth instead of
+// one per row. Views into it are valid until it grows.
+class RowSet{
 public:
-    map<string, void*> value;
+    RowSet(Table* t);
+
+    void Add(const void* slot); // copies a row slot
+    Row Append(); // a zeroed row at the end
+    void Clear();
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Row operator[](size_t i);
+
+public:
+    Table* table;
+
+private:
+    vector<char> arena;
+    size_t count;
+};
+
+// Streams the rows of a select, see Table::OpenScan and Table::OpenRange. NextBatch
+// hands out up to max rowIds per call, Next reads the rows one at a time on top of it.
+// Through an index rows come in key order, a scan yields them in rowId order.
+class RowCursor{
+public:
+    RowCursor(Table* t);
+    virtual ~RowCursor();
+
+    virtual uint32_t NextBatch(uint32_t* outRowIds, uint32_t max) = 0; // 0 once done
+    bool Next(Row& view); // points view at the next row's slot, valid until the cursor reads on; false once done
+    virtual uint64_t Count(); // reads the rest of the rows and returns how many there were
+
+public:
+    inline static const uint32_t BATCH_ROWS = 256;
+
+protected:
+    Table* table;
+
+private:
+    void ReleasePage();
+
+    uint32_t batch[BATCH_ROWS];
+    uint32_t batchPos;
+    uint32_t batchSize;
+    char* page; // pinned page of the last row Next returned
+    uint32_t pageNum;
 };
 
 class Table{
@@ -44,6 +110,7 @@ public:
     
 
     Row* ParseRow(stringstream &ss);
+    void ParseRow(stringstream &ss, Row& dest);
     void SerializeRow(Row* src, void* dest);
     void DeserializeRow(void* src, Row* dest);
     void AddColumn(Column* c);
@@ -51,19 +118,27 @@ public:
 
     bool IsRowDeleted(uint32_t rowId);
     void MarkRowDeleted(uint32_t rowId);
+    void DeleteRow(uint32_t rowId); // marks the row deleted and removes it from every index
     uint32_t GetNextRowId();
     void CreateIndex(const string& columnName);
+    Result BuildIndex(const string& columnName); // CREATE INDEX on a table that may already hold rows
 
     void Insert(Row* row);
+    void InsertBatch(RowSet& rows); // every index takes the whole batch at once
+    RowCursor* OpenScan(); // every live row, the caller deletes the cursor
+    RowCursor* OpenRange(const string& colName, void* L, void* R); // nullptr if there is no such column
     void SelectRange(const string& colName, void* L, void* R, vector<uint32_t>& out);
+    uint32_t CountRange(const string& colName, void* L, void* R);
+    uint32_t LiveRows(); // rowIds handed out minus those waiting for reuse
     uint32_t DeleteRange(const string& colName, void* L, void* R);
+    uint32_t DeleteRows(RowCursor* cursor); // every row the cursor yields, then deletes the cursor
+    void SaveZones(); // at commit, see ZoneMap
+    void LoadZones(); // from the last commit's file, or rebuilt from the heap if it doesn't match
 
 private:
-    template <typename T>
-    void SelectScan(Column* col, void* L, void* R, vector<uint32_t>& out);
-
-    template <typename T>
-    uint32_t DeleteScan(Column* col, void* L, void* R);
+    string IndexFileName(const string& columnName);
+    string ZoneFileName();
+    BtreeIndex* NewIndex(Column* col, Pager* p); // the Btree<T> that fits the column's type
 
 
 public:
@@ -73,6 +148,7 @@ public:
     vector<uint32_t> freeList;
     map<string, BtreeIndex*> colIdx;
     map<string, Column*> colPtr;
+    ZoneMap zones; // per page min/max of the int columns
     Pager* pager;
 
     uint32_t rowCount;
@@ -0,0 +1,56 @@
+// Stats.h
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+using namespace std;
+
+
+// Counters kept by every Pager. The BufferPool folds them into closedStats when a file closes.
+struct PagerStats{
+    uint64_t hits = 0; // served from the pool or the mapping
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t dirtyEvictions = 0; // evicted before a commit, so logged to the WAL
+    uint64_t pagesRead = 0; // from the file or the WAL
+    uint64_t pagesWritten = 0; // by checkpoints
+    uint64_t bytesSynced = 0;
+    uint64_t ioNanos = 0; // reads, checkpoint writes and fsyncs
+
+    PagerStats& operator+=(const PagerStats& o){
+        hits += o.hits;
+        misses += o.misses;
+        evictions += o.evictions;
+        dirtyEvictions += o.dirtyEvictions;
+        pagesRead += o.pagesRead;
+        pagesWritten += o.pagesWritten;
+        bytesSynced += o.bytesSynced;
+        ioNanos += o.ioNanos;
+        return *this;
+    }
+};
+
+struct WalStats{
+    uint64_t pagesLogged = 0;
+    uint64_t commits = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t syncs = 0;
+    uint64_t bytesSynced = 0;
+    uint64_t checkpoints = 0;
+    uint64_t ioNanos = 0; // waiting on log writes and fsyncs
+};
+
+// Adds the time until it goes out of scope to a counter
+class IoTimer {
+public:
+    IoTimer(uint64_t& total) : total(total), start(chrono::steady_clock::now()) {}
+    ~IoTimer(){
+        total += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    uint64_t& total;
+    chrono::steady_clock::time_point start;
+};
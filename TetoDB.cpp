@@ -7,6 +7,9 @@
 
 #include "Database.h"
 #include "CommandDispatcher.h"
+#include "BufferPool.h"
+#include "Btree.h"
+#include "WorkerPool.h"
 
 
 
@@ -34,17 +37,36 @@ void RunCommandWithTimer(const string& line) {
 }
 
 int main(int argc, char* argv[]){
-    if(argc<2){
+    // options start with "--", everything else is positional
+    BufferPoolConfig poolConfig;
+    vector<string> args;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg.rfind("--cache-pages=", 0) == 0) poolConfig.maxPages = stoul(arg.substr(14));
+        else if(arg == "--io=uring") poolConfig.ioBackend = IoBackendType::URING;
+        else if(arg == "--io=posix") poolConfig.ioBackend = IoBackendType::POSIX;
+        else if(arg == "--mmap") poolConfig.mmapFiles = true;
+        else if(arg == "--huge-pages=thp") poolConfig.hugePages = HugePages::TRANSPARENT;
+        else if(arg == "--huge-pages=explicit") poolConfig.hugePages = HugePages::EXPLICIT;
+        else if(arg == "--direct-io") poolConfig.directIo = true;
+        else if(arg.rfind("--index-buffer=", 0) == 0) BtreeIndex::writeBufferCells = stoul(arg.substr(15));
+        else if(arg.rfind("--scan-threads=", 0) == 0) WorkerPool::InitInstance(stoul(arg.substr(15)));
+        else args.push_back(arg);
+    }
+
+    if(args.size()<1){
         cout << "Need filename" <<endl;
         return -1;
     }
+
+    BufferPool::InitInstance(poolConfig);
     
-    string dbName = argv[1];
+    string dbName = args[0];
     Database::InitInstance(dbName);
     auto& dbInstance = Database::GetInstance();
 
-    if(argc>=3){
-        string txtFileName = argv[2];
+    if(args.size()>=2){
+        string txtFileName = args[1];
         ifstream txtFile(txtFileName);
         
 
@@ -0,0 +1,278 @@
+// Wal.cpp
+
+#include "Wal.h"
+#include "BufferPool.h" // PAGE_SIZE
+#include "IoBackend.h"
+#include "Platform.h"
+
+#include <iostream>
+#include <cstring>
+#include <map>
+
+
+static uint32_t Checksum(const char* data, uint64_t len){
+    uint32_t h = 2166136261u; // FNV-1a
+    for(uint64_t i = 0; i < len; i++){
+        h ^= (uint8_t)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+Wal::Wal(const string& fileName, IoBackend* io)
+    : fileName(fileName), hasUncommitted(false), io(io), bufferStart(0), writingStart(0), writePending(false), durableLsn(0), syncing(false)
+{
+    fileDescriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_BINARY, S_IWUSR | S_IRUSR);
+    if(fileDescriptor == -1){
+        cerr << "Error: Unable to open log file " << fileName << endl;
+        exit(1);
+    }
+
+    Recover();
+    buffer.reserve(WAL_BUFFER_SIZE + PAGE_SIZE + sizeof(WalRecordHeader) + 256);
+    writing.reserve(buffer.capacity());
+}
+
+Wal::~Wal(){
+    WaitWrite();
+    close(fileDescriptor);
+}
+
+void Wal::Recover(){
+    struct stat st;
+    if(fstat(fileDescriptor, &st) != 0 || st.st_size == 0) return;
+
+    vector<char> log(st.st_size);
+    uint64_t got = io->Read(fileDescriptor, 0, log.data(), log.size()) ? log.size() : 0;
+
+    // find the end of the last complete commit, a torn tail is ignored
+    uint64_t pos = 0, committedEnd = 0;
+    while(pos + sizeof(WalRecordHeader) <= got){
+        WalRecordHeader* h = (WalRecordHeader*)&log[pos];
+        uint64_t len = sizeof(WalRecordHeader);
+        if(h->type == WAL_PAGE) len += h->nameLen + PAGE_SIZE;
+        else if(h->type == WAL_DROP) len += h->nameLen;
+        else if(h->type != WAL_COMMIT) break;
+
+        if(pos + len > got) break;
+        if(Checksum(&log[pos] + sizeof(uint32_t), len - sizeof(uint32_t)) != h->checksum) break;
+
+        pos += len;
+        if(h->type == WAL_COMMIT) committedEnd = pos;
+    }
+
+    // redo the latest committed image of every page; a file removed meanwhile may have
+    // been created again, and must not get back the pages of the old one
+    map<string, map<uint32_t, char*>> latest;
+    pos = 0;
+    while(pos < committedEnd){
+        WalRecordHeader* h = (WalRecordHeader*)&log[pos];
+        if(h->type == WAL_COMMIT){
+            pos += sizeof(WalRecordHeader);
+            continue;
+        }
+
+        string pageFile(&log[pos + sizeof(WalRecordHeader)], h->nameLen);
+        pos += sizeof(WalRecordHeader) + h->nameLen;
+        if(h->type == WAL_DROP){
+            latest.erase(pageFile);
+            continue;
+        }
+        latest[pageFile][h->pageNum] = &log[pos];
+        pos += PAGE_SIZE;
+    }
+
+    map<string, int> files;
+    vector<IoRequest> batch;
+    for(auto const& [pageFile, pages] : latest){
+        int fd = open(pageFile.c_str(), O_RDWR | O_CREAT | O_BINARY, S_IWUSR | S_IRUSR);
+        files[pageFile] = fd;
+        if(fd == -1) continue;
+        for(auto const& [pageNum, image] : pages){
+            batch.push_back({fd, (uint64_t)pageNum * PAGE_SIZE, image, PAGE_SIZE, true});
+        }
+    }
+    io->Submit(batch);
+    if(!io->WaitAll()){
+        cerr << "Error: Failed to replay " << fileName << endl;
+        exit(1);
+    }
+    uint32_t redone = batch.size();
+
+    for(auto const& [name, fd] : files){
+        if(fd == -1) continue;
+        SyncFile(fd);
+        close(fd);
+    }
+
+    if(redone > 0) cout << "Recovered " << redone << " pages from " << fileName << endl;
+
+    TruncateFile(fileDescriptor, 0);
+    SyncFile(fileDescriptor);
+}
+
+uint64_t Wal::AppendPage(const string& pageFile, uint32_t pageNum, const void* data){
+    lock_guard<mutex> lock(mtx);
+
+    uint64_t start = buffer.size();
+    uint64_t len = sizeof(WalRecordHeader) + pageFile.size() + PAGE_SIZE;
+    buffer.resize(start + len);
+
+    WalRecordHeader* h = (WalRecordHeader*)&buffer[start];
+    h->type = WAL_PAGE;
+    h->reserved = 0;
+    h->nameLen = pageFile.size();
+    h->pageNum = pageNum;
+
+    char* name = &buffer[start + sizeof(WalRecordHeader)];
+    memcpy(name, pageFile.data(), pageFile.size());
+    memcpy(name + pageFile.size(), data, PAGE_SIZE);
+
+    h->checksum = Checksum(&buffer[start] + sizeof(uint32_t), len - sizeof(uint32_t));
+
+    uint64_t imageOffset = bufferStart + start + sizeof(WalRecordHeader) + pageFile.size();
+    hasUncommitted = true;
+    stats.pagesLogged++;
+
+    if(buffer.size() >= WAL_BUFFER_SIZE) FlushBuffer();
+
+    return imageOffset;
+}
+
+void Wal::AppendDrop(const string& pageFile){
+    lock_guard<mutex> lock(mtx);
+
+    uint64_t start = buffer.size();
+    uint64_t len = sizeof(WalRecordHeader) + pageFile.size();
+    buffer.resize(start + len);
+
+    WalRecordHeader* h = (WalRecordHeader*)&buffer[start];
+    h->type = WAL_DROP;
+    h->reserved = 0;
+    h->nameLen = pageFile.size();
+    h->pageNum = 0;
+    memcpy(&buffer[start + sizeof(WalRecordHeader)], pageFile.data(), pageFile.size());
+
+    h->checksum = Checksum(&buffer[start] + sizeof(uint32_t), len - sizeof(uint32_t));
+    hasUncommitted = true;
+
+    if(buffer.size() >= WAL_BUFFER_SIZE) FlushBuffer();
+}
+
+void Wal::ReadPage(uint64_t offset, void* dest){
+    lock_guard<mutex> lock(mtx);
+
+    if(offset >= bufferStart){
+        memcpy(dest, &buffer[offset - bufferStart], PAGE_SIZE);
+        return;
+    }
+    if(writePending && offset >= writingStart){
+        memcpy(dest, &writing[offset - writingStart], PAGE_SIZE);
+        return;
+    }
+
+    if(!io->Read(fileDescriptor, offset, dest, PAGE_SIZE)){
+        cerr << "Error: Failed to read page image from " << fileName << endl;
+        exit(1);
+    }
+}
+
+void Wal::FlushBuffer(){
+    if(buffer.empty()) return;
+
+    WaitWrite(); // at most one buffer in flight
+    swap(buffer, writing);
+    writingStart = bufferStart;
+    bufferStart += writing.size();
+    buffer.clear();
+
+    writeBatch.assign(1, {fileDescriptor, writingStart, writing.data(), (uint32_t)writing.size(), true});
+    stats.bytesWritten += writing.size();
+    io->Submit(writeBatch);
+    writePending = true;
+}
+
+void Wal::WaitWrite(){
+    if(!writePending) return;
+
+    IoTimer timer(stats.ioNanos);
+    if(!io->WaitAll()){
+        cerr << "Error: Failed to write to log file " << fileName << endl;
+        exit(1);
+    }
+    writePending = false;
+}
+
+void Wal::Commit(){
+    uint64_t lsn;
+    {
+        lock_guard<mutex> lock(mtx);
+        if(!hasUncommitted) return; // nothing new, the last fsync already covers us
+
+        uint64_t start = buffer.size();
+        buffer.resize(start + sizeof(WalRecordHeader));
+
+        WalRecordHeader* h = (WalRecordHeader*)&buffer[start];
+        h->type = WAL_COMMIT;
+        h->reserved = 0;
+        h->nameLen = 0;
+        h->pageNum = 0;
+        h->checksum = Checksum(&buffer[start] + sizeof(uint32_t), sizeof(WalRecordHeader) - sizeof(uint32_t));
+
+        FlushBuffer();
+        WaitWrite();
+        hasUncommitted = false;
+        stats.commits++;
+        lsn = bufferStart;
+    }
+
+    WaitDurable(lsn);
+}
+
+void Wal::WaitDurable(uint64_t lsn){
+    unique_lock<mutex> lock(mtx);
+
+    while(durableLsn < lsn){
+        if(syncing){
+            // another committer is already syncing, its fsync may cover us too
+            synced.wait(lock);
+            continue;
+        }
+
+        syncing = true;
+        uint64_t target = bufferStart; // everything written so far
+        lock.unlock();
+
+        uint64_t syncNanos = 0;
+        {
+            IoTimer timer(syncNanos);
+            SyncFile(fileDescriptor);
+        }
+
+        lock.lock();
+        stats.syncs++;
+        stats.bytesSynced += target - min(durableLsn, target);
+        stats.ioNanos += syncNanos;
+        durableLsn = max(durableLsn, target);
+        syncing = false;
+        synced.notify_all();
+    }
+}
+
+void Wal::Reset(){
+    lock_guard<mutex> lock(mtx);
+
+    WaitWrite();
+    buffer.clear();
+    bufferStart = 0;
+    durableLsn = 0;
+    hasUncommitted = false;
+
+    TruncateFile(fileDescriptor, 0);
+    SyncFile(fileDescriptor);
+}
+
+uint64_t Wal::Size(){
+    lock_guard<mutex> lock(mtx);
+    return bufferStart + buffer.size();
+}
@@ -0,0 +1,82 @@
+// Wal.h
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+#include "IoBackend.h"
+#include "Stats.h"
+
+using namespace std;
+
+
+const uint64_t WAL_BUFFER_SIZE = 1 << 20; // appends are batched into 1MB writes
+const uint64_t WAL_CHECKPOINT_SIZE = 64ull << 20; // checkpoint once the log passes 64MB
+
+enum WalRecordType : uint8_t {
+    WAL_PAGE = 1,
+    WAL_COMMIT = 2,
+    WAL_DROP = 3
+};
+
+// Every record starts with this header.
+// WAL_PAGE records are followed by the file name and a full page image,
+// WAL_DROP records by the name of a file that was removed.
+struct WalRecordHeader{
+    uint32_t checksum; // covers everything after this field
+    WalRecordType type;
+    uint8_t reserved;
+    uint16_t nameLen;
+    uint32_t pageNum;
+};
+
+// Database-wide redo log of page images.
+// Pages evicted before a commit and pages dirty at commit time are appended here,
+// and a commit record makes everything before it durable with a single fsync.
+// Records after the last commit record are ignored by recovery.
+class Wal {
+public:
+    Wal(const string& fileName, IoBackend* io);
+    ~Wal();
+
+    uint64_t AppendPage(const string& pageFile, uint32_t pageNum, const void* data); // returns where the image is stored
+    void AppendDrop(const string& pageFile); // the file was removed, recovery skips the images logged before
+    void ReadPage(uint64_t offset, void* dest);
+    void Commit();
+    void Reset(); // called after a checkpoint wrote every logged page to its file
+
+    uint64_t Size();
+
+private:
+    void Recover();
+    void FlushBuffer(); // starts writing the buffer, the write may still be in flight on return
+    void WaitWrite();
+    void WaitDurable(uint64_t lsn);
+
+public:
+    string fileName;
+    int fileDescriptor;
+    bool hasUncommitted; // records appended since the last commit record
+    WalStats stats;
+
+private:
+    IoBackend* io;
+
+    vector<char> buffer; // appended records not yet written to the file
+    uint64_t bufferStart; // file offset of buffer[0]
+
+    vector<char> writing; // previous buffer, possibly still being written
+    uint64_t writingStart;
+    vector<IoRequest> writeBatch;
+    bool writePending;
+
+    // group commit: one committer fsyncs on behalf of everyone waiting
+    mutex mtx;
+    condition_variable synced;
+    uint64_t durableLsn;
+    bool syncing;
+};
@@ -0,0 +1,48 @@
+// WorkerPool.cpp
+
+#include "WorkerPool.h"
+
+
+WorkerPool* WorkerPool::instance = nullptr;
+
+WorkerPool& WorkerPool::GetInstance(){
+    if(!instance) instance = new WorkerPool(0);
+    return *instance;
+}
+
+void WorkerPool::InitInstance(uint32_t size){
+    if(!instance) instance = new WorkerPool(size);
+}
+
+WorkerPool::WorkerPool(uint32_t size){
+    if(size == 0) size = max(1u, thread::hardware_concurrency());
+    for(uint32_t i = 1; i < size; i++){
+        threads.emplace_back(&WorkerPool::Work, this);
+        threads.back().detach();
+    }
+}
+
+uint32_t WorkerPool::Size(){
+    return threads.size() + 1;
+}
+
+void WorkerPool::Submit(function<void()> task){
+    {
+        lock_guard<mutex> lock(mtx);
+        tasks.push_back(move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkerPool::Work(){
+    while(true){
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mtx);
+            wake.wait(lock, [&]{ return !tasks.empty(); });
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
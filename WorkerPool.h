@@ -0,0 +1,37 @@
+// WorkerPool.h
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+
+// Threads that run the tasks of parallel scans, see MorselScan. The thread that starts
+// a scan works on it too, so a pool of size n has n - 1 threads of its own; with a
+// size of 1 every scan stays on the calling thread.
+class WorkerPool{
+public:
+    static WorkerPool& GetInstance();
+    static void InitInstance(uint32_t size); // 0 for one thread per core, call before the first scan
+
+    uint32_t Size(); // threads a scan can use, the caller included
+    void Submit(function<void()> task);
+
+private:
+    WorkerPool(uint32_t size);
+    void Work();
+
+    vector<thread> threads;
+    deque<function<void()>> tasks;
+    mutex mtx;
+    condition_variable wake;
+
+    static WorkerPool* instance; // never destroyed, idle threads wait until the process exits
+};
@@ -0,0 +1,86 @@
+// ZoneMap.cpp
+
+#include "ZoneMap.h"
+#include "Schema.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+
+void ZoneMap::AddColumn(Column* c){
+    if(c->type != INT) return;
+    columns.push_back(c);
+    zones.emplace_back();
+}
+
+void ZoneMap::Widen(uint32_t pageNum, const char* row){
+    for(size_t i = 0; i < columns.size(); i++){
+        vector<Zone>& z = zones[i];
+        // a page no row was written to holds no value, its zone is empty
+        if(z.size() <= pageNum) z.resize(pageNum + 1, { numeric_limits<int32_t>::max(), numeric_limits<int32_t>::min() });
+
+        int32_t v;
+        memcpy(&v, row + columns[i]->offset, sizeof(v));
+        z[pageNum].min = min(z[pageNum].min, v);
+        z[pageNum].max = max(z[pageNum].max, v);
+    }
+}
+
+void ZoneMap::Clear(){
+    for(vector<Zone>& z : zones) z.clear();
+}
+
+int32_t ZoneMap::ColumnOf(Column* c) const {
+    for(size_t i = 0; i < columns.size(); i++){
+        if(columns[i] == c) return i;
+    }
+    return -1;
+}
+
+bool ZoneMap::MayMatch(int32_t col, uint32_t pageNum, int32_t L, int32_t R) const {
+    const vector<Zone>& z = zones[col];
+    if(pageNum >= z.size()) return false; // nothing was ever written past the last zone
+    return z[pageNum].min <= R && L <= z[pageNum].max;
+}
+
+void ZoneMap::Save(const string& fileName, uint32_t rowCount){
+    // written aside and renamed, so a crash leaves either the old file or the new one
+    string tmpName = fileName + ".tmp";
+    ofstream ofs(tmpName, ios::binary | ios::trunc);
+    if(!ofs.is_open()) return;
+
+    uint32_t header[2] = { rowCount, (uint32_t)columns.size() };
+    ofs.write((const char*)header, sizeof(header));
+    for(const vector<Zone>& z : zones){
+        uint32_t pages = z.size();
+        ofs.write((const char*)&pages, sizeof(pages));
+        ofs.write((const char*)z.data(), pages * sizeof(Zone));
+    }
+    ofs.close();
+    if(ofs) rename(tmpName.c_str(), fileName.c_str());
+}
+
+bool ZoneMap::Load(const string& fileName, uint32_t rowCount, uint32_t pages){
+    ifstream ifs(fileName, ios::binary);
+    if(!ifs.is_open()) return false;
+
+    uint32_t header[2];
+    if(!ifs.read((char*)header, sizeof(header))) return false;
+    if(header[0] != rowCount || header[1] != columns.size()) return false;
+
+    for(vector<Zone>& z : zones){
+        uint32_t n;
+        if(!ifs.read((char*)&n, sizeof(n)) || n > pages){
+            Clear();
+            return false;
+        }
+        z.resize(n);
+        if(!ifs.read((char*)z.data(), n * sizeof(Zone))){
+            Clear();
+            return false;
+        }
+    }
+    return true;
+}
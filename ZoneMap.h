@@ -0,0 +1,42 @@
+// ZoneMap.h
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Column;
+
+
+// The smallest and largest value of every int column on each heap page. A range scan
+// without an index skips, unread, the pages whose [min, max] misses its range.
+// Zones only ever widen: a delete leaves them as they are and a reused slot widens its
+// page again, so they may be looser than the page but never exclude one of its rows.
+class ZoneMap{
+public:
+    void AddColumn(Column* c); // only int columns get zones, call in schema order
+    void Widen(uint32_t pageNum, const char* row); // row in its slot layout
+    void Clear();
+
+    uint32_t Columns() const { return columns.size(); }
+    int32_t ColumnOf(Column* c) const; // its zones, or -1 if it has none
+    bool MayMatch(int32_t col, uint32_t pageNum, int32_t L, int32_t R) const;
+
+    // The file records the rowCount it was saved at. Load fails on a missing or
+    // short file, or one that doesn't match rowCount and the columns, and leaves
+    // the map empty: the table rebuilds it from the heap then.
+    void Save(const string& fileName, uint32_t rowCount);
+    bool Load(const string& fileName, uint32_t rowCount, uint32_t pages);
+
+private:
+    struct Zone{
+        int32_t min;
+        int32_t max;
+    };
+
+    vector<Column*> columns;
+    vector<vector<Zone>> zones; // zones[i][pageNum] for columns[i]
+};
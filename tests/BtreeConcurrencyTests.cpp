@@ -0,0 +1,208 @@
+#include "../Btree.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+
+/// <summary>
+/// The pool is much smaller than the trees built here, so nodes are evicted,
+/// logged and read back while the threads are latching them.
+/// </summary>
+class BtreeConcurrencyTests : public ::testing::Test
+{
+protected:
+	static void SetUpTestSuite()
+	{
+		BufferPoolConfig config;
+		config.maxPages = 1024;
+		BufferPool::InitInstance(config);
+		remove("concurrency_test.wal");
+		BufferPool::GetInstance().OpenWal("concurrency_test.wal");
+	}
+};
+
+/// <summary>
+/// Key k as the bytes Btree<T>::Insert reads: the int itself, or big-endian
+/// in a zero-padded char key so that both orders agree.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+template<typename T>
+static void MakeKey(int32_t k, char* out)
+{
+	memset(out, 0, sizeof(T));
+	if constexpr (is_same_v<T, int32_t>) memcpy(out, &k, sizeof(k));
+	else for (int i = 0; i < 4; i++) out[i] = (char)(k >> (24 - 8 * i));
+}
+
+/// <summary>
+/// Writers and readers share one tree. Writer w owns the keys equal to w modulo the
+/// writer count, so it knows exactly which of its cells are in the tree and checks
+/// them while the others write. Keys below STABLE are loaded first and never deleted:
+/// readers check every range of them exactly. Writers grow the tree for half their
+/// operations and shrink it for the rest, so splits, merges and root changes all race
+/// with the readers. Afterwards the structure and the contents are checked.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+template<typename T>
+static void RunStress(const string& fileName, uint32_t writers, uint32_t readers, uint32_t opsPerWriter, int32_t keySpace)
+{
+	const int32_t STABLE = 2000;
+
+	remove(fileName.c_str());
+	Btree<T>* tree = new Btree<T>(new Pager(fileName), nullptr);
+	tree->CreateIndex();
+
+	char key[sizeof(T)];
+	for (int32_t k = 0; k < STABLE; k++) {
+		MakeKey<T>(k, key);
+		tree->Insert(key, k);
+	}
+
+	atomic<bool> done(false);
+	atomic<uint64_t> failures(0), reads(0);
+	vector<vector<pair<int32_t, uint32_t>>> live(writers);
+	vector<thread> threads;
+
+	for (uint32_t w = 0; w < writers; w++) threads.emplace_back([&, w]() {
+		mt19937 rng(w + 1);
+		vector<pair<int32_t, uint32_t>>& mine = live[w];
+		unordered_map<int32_t, uint32_t> counts;
+		char key[sizeof(T)];
+
+		for (uint32_t i = 0; i < opsPerWriter; i++) {
+			uint32_t dice = rng() % 100;
+			uint32_t insertShare = i < opsPerWriter / 2 ? 60 : 30;
+
+			if (dice < insertShare || mine.empty()) {
+				int32_t k = STABLE + (int32_t)(rng() % (keySpace / writers)) * writers + w;
+				uint32_t rowId = STABLE + i * writers + w;
+				MakeKey<T>(k, key);
+				tree->Insert(key, rowId);
+				mine.push_back({ k, rowId });
+				counts[k]++;
+			}
+			else if (dice < 90) {
+				size_t j = rng() % mine.size();
+				swap(mine[j], mine.back());
+				MakeKey<T>(mine.back().first, key);
+				if (!tree->Delete(key, mine.back().second)) failures++;
+				counts[mine.back().first]--;
+				mine.pop_back();
+			}
+			else {
+				int32_t k = mine[rng() % mine.size()].first;
+				MakeKey<T>(k, key);
+				if (tree->CountRange(key, key) != counts[k]) failures++;
+			}
+		}
+	});
+
+	for (uint32_t r = 0; r < readers; r++) threads.emplace_back([&, r]() {
+		mt19937 rng(100 + r);
+		char lo[sizeof(T)], hi[sizeof(T)];
+
+		while (!done) {
+			int32_t a = rng() % STABLE;
+			int32_t b = a + rng() % (STABLE - a);
+			MakeKey<T>(a, lo);
+			MakeKey<T>(b, hi);
+
+			// stable key k has rowId k, so the exact answer is known; it is read in small
+			// batches, so the cursor resumes from leaves the writers change in between
+			vector<uint32_t> rowIds;
+			BtreeCursor* cursor = tree->OpenRange(lo, hi);
+			uint32_t batch[64];
+			while (uint32_t n = cursor->Next(batch, 1 + rng() % 64)) rowIds.insert(rowIds.end(), batch, batch + n);
+			delete cursor;
+			bool exact = rowIds.size() == (size_t)(b - a + 1);
+			for (size_t i = 0; exact && i < rowIds.size(); i++) exact = rowIds[i] == (uint32_t)(a + i);
+			if (!exact) failures++;
+
+			// a range over the writers' keys is never repeated or torn: no rowId twice
+			a = STABLE + rng() % keySpace;
+			MakeKey<T>(a, lo);
+			MakeKey<T>(a + 200, hi);
+			rowIds.clear();
+			tree->SelectRange(lo, hi, rowIds);
+			sort(rowIds.begin(), rowIds.end());
+			if (adjacent_find(rowIds.begin(), rowIds.end()) != rowIds.end()) failures++;
+
+			reads++;
+		}
+	});
+
+	for (uint32_t w = 0; w < writers; w++) threads[w].join();
+	done = true;
+	for (uint32_t r = 0; r < readers; r++) threads[writers + r].join();
+
+	EXPECT_EQ(failures, 0u);
+	EXPECT_GT(reads, 0u);
+	EXPECT_EQ(tree->Check(), "");
+
+	vector<uint32_t> expected;
+	for (int32_t k = 0; k < STABLE; k++) expected.push_back(k);
+	for (auto& mine : live) for (auto& cell : mine) expected.push_back(cell.second);
+	sort(expected.begin(), expected.end());
+
+	char lo[sizeof(T)], hi[sizeof(T)];
+	MakeKey<T>(0, lo);
+	MakeKey<T>(STABLE + keySpace, hi);
+	vector<uint32_t> rowIds;
+	tree->SelectRange(lo, hi, rowIds);
+	sort(rowIds.begin(), rowIds.end());
+	EXPECT_EQ(rowIds, expected);
+
+	// every writer empties its share at once: the tree shrinks back to the stable keys
+	threads.clear();
+	for (uint32_t w = 0; w < writers; w++) threads.emplace_back([&, w]() {
+		char key[sizeof(T)];
+		for (auto& cell : live[w]) {
+			MakeKey<T>(cell.first, key);
+			if (!tree->Delete(key, cell.second)) failures++;
+		}
+	});
+	for (thread& t : threads) t.join();
+
+	EXPECT_EQ(failures, 0u);
+	EXPECT_EQ(tree->Check(), "");
+	EXPECT_EQ(tree->CountRange(lo, hi), (uint32_t)STABLE);
+
+	delete tree;
+	remove(fileName.c_str());
+}
+
+/// <summary>
+/// Two million writes on int keys, with many cells per leaf and a shallow tree.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST_F(BtreeConcurrencyTests, IntKeysStressTest)
+{
+	RunStress<int32_t>("concurrency_int.btree", 4, 2, 500000, 100000);
+}
+
+/// <summary>
+/// Eight writers on 64 keys: the newest cells of every key land in the same few
+/// leaves, so writers keep racing for the same latches.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST_F(BtreeConcurrencyTests, HotKeysStressTest)
+{
+	RunStress<int32_t>("concurrency_hot.btree", 8, 2, 100000, 64);
+}
+
+/// <summary>
+/// Wide char keys fit 15 to a leaf: the tree is deep and most writes split or
+/// merge nodes, so writers mostly take the latched path down from the root.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST_F(BtreeConcurrencyTests, WideKeysStressTest)
+{
+	RunStress<FixedKey<MAX_KEY_SIZE>>("concurrency_wide.btree", 4, 2, 50000, 20000);
+}
@@ -0,0 +1,518 @@
+#include "../Pager.h"
+#include "../Wal.h"
+#include "../Platform.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+
+/// <summary>
+/// Every test in this file shares one tiny pool, so eviction is exercised
+/// after only a handful of pages.
+/// </summary>
+class BufferPoolTests : public ::testing::Test
+{
+protected:
+	static void SetUpTestSuite()
+	{
+		BufferPoolConfig config;
+		config.maxPages = 16;
+		BufferPool::InitInstance(config);
+		remove("pool_test.wal");
+		BufferPool::GetInstance().OpenWal("pool_test.wal");
+	}
+};
+
+/// <summary>
+/// Two files share the same frames: touching more pages than the pool holds
+/// across both files must spill and reload them without mixing contents.
+/// </summary>
+TEST_F(BufferPoolTests, FilesShareOnePoolTest)
+{
+	remove("pool_a.db");
+	remove("pool_b.db");
+	Pager* a = new Pager("pool_a.db");
+	Pager* b = new Pager("pool_b.db");
+	EXPECT_NE(a->fileId, b->fileId);
+
+	for (uint32_t i = 0; i < 40; i++) {
+		*(uint32_t*)a->GetPage(i, 1) = i;
+		*(uint32_t*)b->GetPage(i, 1) = 1000 + i;
+	}
+	EXPECT_EQ(BufferPool::GetInstance().framesAllocated, 16u);
+
+	for (uint32_t i = 0; i < 40; i++) {
+		EXPECT_EQ(*(uint32_t*)a->GetPage(i, 0), i);
+		EXPECT_EQ(*(uint32_t*)b->GetPage(i, 0), 1000 + i);
+	}
+
+	delete a;
+	delete b;
+	remove("pool_a.db");
+	remove("pool_b.db");
+}
+
+/// <summary>
+/// Pages committed and checkpointed by one pager can be read back by a new pager
+/// on the same file, even when they were evicted from the pool before the commit.
+/// </summary>
+TEST_F(BufferPoolTests, FlushAndReopenTest)
+{
+	remove("pool_c.db");
+	Pager* p = new Pager("pool_c.db");
+	for (uint32_t i = 0; i < 30; i++) {
+		char* page = (char*)p->GetPage(i, 1);
+		memset(page, 'a' + i % 26, PAGE_SIZE);
+	}
+	BufferPool::GetInstance().Commit();
+	BufferPool::GetInstance().Checkpoint();
+	delete p;
+
+	p = new Pager("pool_c.db");
+	EXPECT_EQ(p->numPages, 30u);
+	for (uint32_t i = 0; i < 30; i++) {
+		char* page = (char*)p->GetPage(i, 0);
+		EXPECT_EQ(page[0], 'a' + i % 26);
+		EXPECT_EQ(page[PAGE_SIZE - 1], 'a' + i % 26);
+	}
+	delete p;
+	remove("pool_c.db");
+}
+
+/// <summary>
+/// A pinned frame keeps its page while many other pages cycle through the pool.
+/// </summary>
+TEST_F(BufferPoolTests, PinnedPageSurvivesEvictionTest)
+{
+	remove("pool_d.db");
+	Pager* p = new Pager("pool_d.db");
+	uint32_t* pinned = (uint32_t*)p->PinPage(0, 1);
+	*pinned = 42;
+
+	for (uint32_t i = 1; i < 100; i++) *(uint32_t*)p->GetPage(i, 1) = i;
+
+	EXPECT_EQ(*pinned, 42u);
+	EXPECT_EQ(pinned, p->GetPage(0, 0));
+	p->UnpinPage(0);
+
+	delete p;
+	remove("pool_d.db");
+}
+
+/// <summary>
+/// A crash after commit but before checkpoint: replaying a copy of the log
+/// restores committed pages and ignores changes logged after the last commit.
+/// </summary>
+TEST_F(BufferPoolTests, RecoverCommittedPagesTest)
+{
+	remove("pool_e.db");
+	BufferPool& pool = BufferPool::GetInstance();
+	Pager* p = new Pager("pool_e.db");
+	for (uint32_t i = 0; i < 30; i++) *(uint32_t*)p->GetPage(i, 1) = 7 * i;
+	pool.Commit();
+
+	// uncommitted changes, logged past the 1MB append buffer so they reach the file
+	uint32_t uncommitted[PAGE_SIZE / 4] = { 12345 };
+	for (uint32_t i = 0; i < 300; i++) pool.wal->AppendPage("pool_e.db", i % 30, uncommitted);
+
+	{
+		std::ifstream src("pool_test.wal", std::ios::binary);
+		std::ofstream dst("pool_crash.wal", std::ios::binary);
+		dst << src.rdbuf();
+	}
+	delete p;
+
+	{
+		Wal recovered("pool_crash.wal", pool.io.get()); // replays on open
+	}
+
+	p = new Pager("pool_e.db");
+	EXPECT_EQ(p->numPages, 30u);
+	for (uint32_t i = 0; i < 30; i++) EXPECT_EQ(*(uint32_t*)p->GetPage(i, 0), 7 * i);
+	delete p;
+
+	remove("pool_e.db");
+	remove("pool_crash.wal");
+}
+
+/// <summary>
+/// A file removed and created again under the same name before a crash only gets
+/// back the pages committed after its removal, the old file's stay dropped.
+/// </summary>
+TEST_F(BufferPoolTests, RecoverRemovedFileTest)
+{
+	remove("pool_n.db");
+	BufferPool& pool = BufferPool::GetInstance();
+	Pager* p = new Pager("pool_n.db");
+	for (uint32_t i = 0; i < 10; i++) *(uint32_t*)p->GetPage(i, 1) = 1000 + i;
+	pool.Commit();
+	delete p;
+
+	pool.RemoveFile("pool_n.db");
+	p = new Pager("pool_n.db");
+	EXPECT_EQ(p->numPages, 0u);
+	for (uint32_t i = 0; i < 2; i++) *(uint32_t*)p->GetPage(i, 1) = 2000 + i;
+	pool.Commit();
+
+	{
+		std::ifstream src("pool_test.wal", std::ios::binary);
+		std::ofstream dst("pool_crash.wal", std::ios::binary);
+		dst << src.rdbuf();
+	}
+	delete p;
+
+	{
+		Wal recovered("pool_crash.wal", pool.io.get()); // replays on open
+	}
+
+	p = new Pager("pool_n.db");
+	EXPECT_EQ(p->numPages, 2u);
+	for (uint32_t i = 0; i < 2; i++) EXPECT_EQ(*(uint32_t*)p->GetPage(i, 0), 2000 + i);
+	delete p;
+
+	remove("pool_n.db");
+	remove("pool_crash.wal");
+}
+
+/// <summary>
+/// Both backends run a batch deeper than the io_uring queue and report every page.
+/// </summary>
+TEST_F(BufferPoolTests, IoBackendBatchTest)
+{
+	for (IoBackendType type : { IoBackendType::POSIX, IoBackendType::URING }) {
+		unique_ptr<IoBackend> io = IoBackend::Create(type);
+		remove("pool_io.db");
+		int fd = open("pool_io.db", O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+		const uint32_t pages = 200;
+		vector<uint32_t> out(pages * PAGE_SIZE / 4), in(pages * PAGE_SIZE / 4);
+		vector<IoRequest> batch;
+		for (uint32_t i = 0; i < pages; i++) {
+			out[i * PAGE_SIZE / 4] = i + 1;
+			batch.push_back({ fd, (uint64_t)i * PAGE_SIZE, &out[i * PAGE_SIZE / 4], PAGE_SIZE, true });
+		}
+		io->Submit(batch);
+		EXPECT_TRUE(io->WaitAll());
+
+		for (IoRequest& req : batch) {
+			req.buffer = (char*)in.data() + req.offset;
+			req.isWrite = false;
+		}
+		io->Submit(batch);
+		EXPECT_TRUE(io->WaitAll());
+		EXPECT_EQ(in, out) << io->Name();
+
+		// reading past the end of the file is an error, not a silent short read
+		char page[PAGE_SIZE];
+		EXPECT_FALSE(io->Read(fd, (uint64_t)pages * PAGE_SIZE, page, PAGE_SIZE));
+
+		close(fd);
+		remove("pool_io.db");
+	}
+}
+
+/// <summary>
+/// A vectored request gathers scattered buffers into one contiguous run of pages,
+/// and the checkpoint built from such runs reads back in order.
+/// </summary>
+TEST_F(BufferPoolTests, VectoredWriteTest)
+{
+	for (IoBackendType type : { IoBackendType::POSIX, IoBackendType::URING }) {
+		unique_ptr<IoBackend> io = IoBackend::Create(type);
+		remove("pool_io.db");
+		int fd = open("pool_io.db", O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+		// pages 0..7 come from buffers stored in reverse order
+		vector<char> out(8 * PAGE_SIZE), in(8 * PAGE_SIZE);
+		vector<iovec> iovs;
+		for (uint32_t i = 0; i < 8; i++) {
+			char* page = &out[(7 - i) * PAGE_SIZE];
+			memset(page, 'a' + i, PAGE_SIZE);
+			iovs.push_back({ page, PAGE_SIZE });
+		}
+		vector<IoRequest> batch = { { fd, 0, nullptr, 8 * PAGE_SIZE, true, iovs.data(), 8 } };
+		io->Submit(batch);
+		EXPECT_TRUE(io->WaitAll());
+
+		EXPECT_TRUE(io->Read(fd, 0, in.data(), in.size()));
+		for (uint32_t i = 0; i < 8; i++) EXPECT_EQ(in[i * PAGE_SIZE], 'a' + i) << io->Name();
+
+		close(fd);
+		remove("pool_io.db");
+	}
+
+	// scattered dirty pages, committed and checkpointed as a few runs
+	remove("pool_f.db");
+	Pager* p = new Pager("pool_f.db");
+	for (uint32_t i = 0; i < 10; i++) p->GetPage(i, 1);
+	for (uint32_t i : { 9u, 3u, 4u, 0u, 5u, 1u, 8u, 2u, 7u, 6u }) *(uint32_t*)p->GetPage(i, 1) = 100 + i;
+	EXPECT_FALSE(p->dirtyPages.empty());
+	BufferPool::GetInstance().Commit();
+	EXPECT_TRUE(p->dirtyPages.empty());
+	BufferPool::GetInstance().Checkpoint();
+	delete p;
+
+	p = new Pager("pool_f.db");
+	EXPECT_EQ(p->numPages, 10u);
+	for (uint32_t i = 0; i < 10; i++) EXPECT_EQ(*(uint32_t*)p->GetPage(i, 0), 100 + i);
+	delete p;
+	remove("pool_f.db");
+}
+
+/// <summary>
+/// In mmap mode clean reads point into the file mapping, writes go to a pool frame,
+/// and a checkpoint that grows the file makes the new pages visible in the mapping.
+/// </summary>
+TEST_F(BufferPoolTests, MmapReadsTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	pool.mmapFiles = true;
+	remove("pool_g.db");
+
+	Pager* p = new Pager("pool_g.db");
+	for (uint32_t i = 0; i < 4; i++) *(uint32_t*)p->GetPage(i, 1) = i;
+	pool.Commit();
+	pool.Checkpoint();
+	delete p;
+
+	p = new Pager("pool_g.db");
+	ASSERT_NE(p->mapping, nullptr);
+	for (uint32_t i = 0; i < 4; i++) {
+		uint32_t* page = (uint32_t*)p->GetPage(i, 0);
+		EXPECT_EQ((char*)page, p->mapping + i * PAGE_SIZE);
+		EXPECT_EQ(*page, i);
+	}
+
+	// a write copies the page into the pool, readers follow the newer copy
+	uint32_t* written = (uint32_t*)p->GetPage(1, 1);
+	EXPECT_NE((char*)written, p->mapping + PAGE_SIZE);
+	*written = 100;
+	EXPECT_EQ(p->GetPage(1, 0), written);
+	EXPECT_EQ(*(uint32_t*)(p->mapping + PAGE_SIZE), 1u);
+
+	*(uint32_t*)p->GetPage(4, 1) = 4;
+	pool.Commit();
+	pool.Checkpoint();
+	EXPECT_EQ(p->mappedLength, 5u * PAGE_SIZE);
+	EXPECT_EQ(*(uint32_t*)(p->mapping + PAGE_SIZE), 100u);
+	EXPECT_EQ(*(uint32_t*)(p->mapping + 4 * PAGE_SIZE), 4u);
+
+	delete p;
+	pool.mmapFiles = false;
+	remove("pool_g.db");
+}
+
+/// <summary>
+/// A page referenced again soon after its first eviction joins the main queue and
+/// survives a long one-time sweep; a guarded scan only cycles through its small ring.
+/// </summary>
+TEST_F(BufferPoolTests, ScanResistanceTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	remove("pool_h.db");
+	remove("pool_i.db");
+	Pager* hot = new Pager("pool_h.db");
+	Pager* cold = new Pager("pool_i.db");
+	auto resident = [&](Pager* p, uint32_t pageNum) {
+		return pool.pageTable.Find(BufferPool::FrameKey(p->fileId, pageNum)) != NO_FRAME;
+	};
+
+	// first reference, pushed out by a sweep, then referenced again: now hot
+	hot->GetPage(0, 1);
+	uint32_t next = 0;
+	while (resident(hot, 0)) cold->GetPage(next++, 1);
+	hot->GetPage(0, 0);
+
+	for (uint32_t i = 0; i < 100; i++) cold->GetPage(next++, 1);
+	EXPECT_TRUE(resident(hot, 0));
+
+	// a scan over another file leaves everything else in place
+	hot->GetPage(1, 1);
+	hot->GetPage(2, 1);
+	{
+		ScanGuard scan(cold);
+		for (uint32_t i = 0; i < next; i++) cold->GetPage(i, 0);
+		EXPECT_LE(cold->scanRing.size(), pool.SCAN_RING_LIMIT);
+	}
+	EXPECT_TRUE(resident(hot, 0));
+	EXPECT_TRUE(resident(hot, 1));
+	EXPECT_TRUE(resident(hot, 2));
+	EXPECT_TRUE(cold->scanRing.empty());
+
+	delete hot;
+	delete cold;
+	remove("pool_h.db");
+	remove("pool_i.db");
+}
+
+/// <summary>
+/// Two misses in a row open a read-ahead window, which slides forward once the
+/// reader is halfway through it; inside a scan the first miss already opens one.
+/// </summary>
+TEST_F(BufferPoolTests, ReadAheadWindowTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	remove("pool_j.db");
+	Pager* p = new Pager("pool_j.db");
+	for (uint32_t i = 0; i < 200; i++) p->GetPage(i, 1);
+	pool.Commit();
+	pool.Checkpoint();
+	delete p;
+
+	const uint32_t window = Pager::READ_AHEAD_PAGES;
+	p = new Pager("pool_j.db");
+	p->GetPage(10, 0);
+	EXPECT_EQ(p->readAheadEnd, 0u);
+	p->GetPage(11, 0);
+	EXPECT_EQ(p->readAheadEnd, 12 + window);
+
+	uint32_t halfway = 12 + window - window / 2;
+	for (uint32_t i = 12; i < halfway; i++) p->GetPage(i, 0);
+	EXPECT_EQ(p->readAheadEnd, 12 + window);
+	p->GetPage(halfway, 0);
+	EXPECT_EQ(p->readAheadEnd, halfway + 1 + window);
+
+	{
+		ScanGuard scan(p);
+		p->GetPage(150, 0);
+		EXPECT_EQ(p->readAheadStart, 150u);
+		EXPECT_EQ(p->readAheadEnd, 151 + window);
+	}
+
+	delete p;
+	remove("pool_j.db");
+}
+
+/// <summary>
+/// A batched read loads only the pages the pool, the log and the file's end don't
+/// already cover, through either backend; the scan that follows hits on every one.
+/// </summary>
+TEST_F(BufferPoolTests, BatchedReadTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	remove("pool_m.db");
+	Pager* p = new Pager("pool_m.db");
+	for (uint32_t i = 0; i < 20; i++) *(uint32_t*)p->GetPage(i, 1) = 100 + i;
+	pool.Commit();
+	pool.Checkpoint();
+	delete p;
+
+	for (IoBackendType type : { IoBackendType::POSIX, IoBackendType::URING }) {
+		unique_ptr<IoBackend> io = IoBackend::Create(type);
+		swap(pool.io, io);
+
+		p = new Pager("pool_m.db");
+		*(uint32_t*)p->GetPage(12, 1) = 500; // only in the log after the commit
+		pool.Commit();
+		p->GetPage(5, 0);
+		p->stats = PagerStats();
+
+		// a run, a gap, a cached page, a logged page and one past the end
+		vector<uint32_t> pages = { 2, 3, 4, 5, 7, 12, 20 };
+		p->ReadPages(pages.data(), pages.size());
+		EXPECT_EQ(p->stats.misses, 4u) << pool.io->Name();
+		EXPECT_EQ(p->stats.pagesRead, 4u) << pool.io->Name();
+
+		for (uint32_t i : { 2u, 3u, 4u, 5u, 7u }) EXPECT_EQ(*(uint32_t*)p->GetPage(i, 0), 100 + i) << pool.io->Name();
+		EXPECT_EQ(p->stats.misses, 4u) << pool.io->Name();
+		EXPECT_EQ(*(uint32_t*)p->GetPage(12, 0), 500u) << pool.io->Name();
+
+		// nothing left to read
+		uint64_t read = p->stats.pagesRead;
+		p->ReadPages(pages.data(), 5);
+		EXPECT_EQ(p->stats.pagesRead, read) << pool.io->Name();
+
+		pool.Checkpoint();
+		delete p;
+		swap(pool.io, io);
+	}
+	remove("pool_m.db");
+}
+
+/// <summary>
+/// The flat page table finds every live key after heavy inserts and erases,
+/// including keys that probed past slots later emptied by a backward shift.
+/// </summary>
+TEST_F(BufferPoolTests, PageTableTest)
+{
+	PageTable table;
+	table.Init(1000);
+
+	for (uint32_t i = 0; i < 1000; i++) table.Insert(BufferPool::FrameKey(i % 7, i), i);
+	EXPECT_EQ(table.Size(), 1000u);
+
+	for (uint32_t i = 0; i < 1000; i += 3) table.Erase(BufferPool::FrameKey(i % 7, i));
+	table.Erase(BufferPool::FrameKey(9, 9)); // absent, no effect
+	table.Insert(BufferPool::FrameKey(1, 1), 5000); // replaces
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		uint32_t expected = i == 1 ? 5000 : (i % 3 == 0 ? NO_FRAME : i);
+		EXPECT_EQ(table.Find(BufferPool::FrameKey(i % 7, i)), expected);
+	}
+	EXPECT_EQ(table.Size(), 666u);
+}
+
+/// <summary>
+/// Frames are slices of one page-aligned arena, and a file opened with direct I/O
+/// round-trips its pages through commit, checkpoint and reopen.
+/// </summary>
+TEST_F(BufferPoolTests, ArenaAndDirectIoTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	EXPECT_EQ((uintptr_t)pool.arena % PAGE_SIZE, 0u);
+	for (uint32_t i = 0; i < pool.MAX_PAGES; i++) {
+		EXPECT_EQ((char*)pool.buffers[i].data, pool.arena + (uint64_t)i * PAGE_SIZE);
+	}
+
+	pool.directIo = true;
+	remove("pool_k.db");
+	Pager* p = new Pager("pool_k.db");
+	for (uint32_t i = 0; i < 40; i++) *(uint32_t*)p->GetPage(i, 1) = 3 * i;
+	pool.Commit();
+	pool.Checkpoint();
+	delete p;
+
+	p = new Pager("pool_k.db");
+	EXPECT_EQ(p->numPages, 40u);
+	for (uint32_t i = 0; i < 40; i++) EXPECT_EQ(*(uint32_t*)p->GetPage(i, 0), 3 * i);
+	delete p;
+
+	pool.directIo = false;
+	remove("pool_k.db");
+}
+
+/// <summary>
+/// Per-file counters follow hits, misses, dirty evictions and checkpoint writes,
+/// and closed files keep contributing to the pool totals.
+/// </summary>
+TEST_F(BufferPoolTests, StatsTest)
+{
+	BufferPool& pool = BufferPool::GetInstance();
+	pool.ResetStats();
+	remove("pool_l.db");
+
+	Pager* p = new Pager("pool_l.db");
+	for (uint32_t i = 0; i < 40; i++) p->GetPage(i, 1);
+	EXPECT_EQ(p->stats.misses, 40u);
+	EXPECT_EQ(p->stats.hits, 0u);
+	EXPECT_EQ(p->stats.evictions, p->stats.dirtyEvictions);
+	EXPECT_EQ(p->stats.evictions, 40u - pool.MAX_PAGES);
+
+	p->GetPage(39, 0);
+	EXPECT_EQ(p->stats.hits, 1u);
+
+	pool.Commit();
+	pool.Checkpoint();
+	EXPECT_EQ(p->stats.pagesWritten, 40u);
+	EXPECT_EQ(p->stats.bytesSynced, 40u * PAGE_SIZE);
+	EXPECT_EQ(pool.wal->stats.commits, 1u);
+	EXPECT_EQ(pool.wal->stats.checkpoints, 1u);
+	EXPECT_EQ(pool.wal->stats.pagesLogged, 40u);
+
+	PagerStats before = p->stats;
+	delete p;
+	EXPECT_EQ(pool.TotalStats().misses, before.misses);
+
+	pool.ResetStats();
+	EXPECT_EQ(pool.TotalStats().misses, 0u);
+	remove("pool_l.db");
+}
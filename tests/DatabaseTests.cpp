@@ -1,6 +1,18 @@
 #include "../Database.h"
+#include "../Schema.h"
+#include "../Btree.h"
+#include "../Pager.h"
+#include "../ExternalSort.h"
+#include "../KeySearch.h"
+#include "../PageScan.h"
+#include "../MorselScan.h"
+#include "../WorkerPool.h"
 #include <gtest/gtest.h>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
 
 /// <summary>
 /// If we does not initialize first, we can't get a database instance.
@@ -19,6 +31,13 @@ TEST(DatabaseTests, EmptyInstanceTest)
 /// <param name=""></param>
 TEST(DatabaseTests, InitializeDatabaseInstanceTest)
 {
+	// scans of more than one morsel use 8 threads in every test, whatever the machine has,
+	// and a small pool makes them reuse each other's frames (and the reader's) all the time
+	WorkerPool::InitInstance(8);
+	BufferPoolConfig config;
+	config.maxPages = 64;
+	BufferPool::InitInstance(config);
+
 	std::string name = "my_db";
 	Database::InitInstance(name);
 	auto& dbInstance = Database::GetInstance();
@@ -39,4 +58,797 @@ TEST(DatabaseTests, SingletonTest)
 	auto& dbInstance = Database::GetInstance();
 	EXPECT_NE(dbInstance.metaFileName, "another_db");
 	EXPECT_EQ(dbInstance.metaFileName, "my_db");
-}
\ No newline at end of file
+}
+
+/// <summary>
+/// With a budget of 64 records, 10000 records spill into many sorted runs,
+/// which must merge back into one sorted stream and be removed afterwards.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, ExternalSortTest)
+{
+	struct Less { bool operator()(uint32_t a, uint32_t b) const { return a < b; } };
+	{
+		ExternalSort<uint32_t, Less> sorter("sort_test", 64 * sizeof(uint32_t));
+		for (uint32_t i = 0; i < 10000; i++) sorter.Add((i * 7919) % 10007);
+		sorter.Finish();
+		EXPECT_EQ(sorter.Count(), 10000u);
+		EXPECT_GT(sorter.Runs(), 1u);
+
+		uint32_t prev = 0, got = 0, value;
+		while (sorter.Next(value)) {
+			EXPECT_LE(prev, value);
+			prev = value;
+			got++;
+		}
+		EXPECT_EQ(got, 10000u);
+	}
+	EXPECT_FALSE(std::ifstream("sort_test.run0").good());
+}
+
+/// <summary>
+/// CREATE INDEX on a table that already has rows bulk loads the tree:
+/// deleted rows are left out, duplicates are kept, and the tree keeps
+/// working for inserts made after the build.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, BulkLoadIndexTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 0 v int 0");
+	ASSERT_EQ(db.CreateTable("bulk", columns), Result::OK);
+	Table* t = db.GetTable("bulk");
+
+	// 5000 distinct ids, each inserted 4 times, in scattered order
+	for (uint32_t i = 0; i < 20000; i++) {
+		std::stringstream row;
+		row << (i * 7919) % 5000 << " " << i;
+		db.Insert("bulk", row);
+	}
+	int32_t l = 100, r = 199;
+	EXPECT_EQ(db.DeleteWithRange(t, "id", &l, &r), 400u);
+
+	EXPECT_EQ(db.CreateIndex("bulk", "id"), Result::OK);
+	EXPECT_EQ(db.CreateIndex("bulk", "id"), Result::ERROR);
+	EXPECT_EQ(db.CreateIndex("missing", "id"), Result::TABLE_NOT_FOUND);
+	ASSERT_TRUE(t->colIdx.count("id"));
+
+	RowSet rows(t);
+	l = 0, r = 4999;
+	db.SelectWithRange(t, "id", &l, &r, rows);
+	EXPECT_EQ(rows.size(), 19600u);
+
+	l = 150, r = 250;
+	db.SelectWithRange(t, "id", &l, &r, rows);
+	EXPECT_EQ(rows.size(), 51u * 4);
+	for (size_t i = 0; i < rows.size(); i++) {
+		EXPECT_GE(*(int32_t*)rows[i].Value("id"), 200);
+	}
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		std::stringstream row;
+		row << 150 << " " << i;
+		db.Insert("bulk", row);
+	}
+	db.SelectWithRange(t, "id", &l, &r, rows);
+	EXPECT_EQ(rows.size(), 51u * 4 + 1000);
+
+	db.DropTable("bulk");
+}
+
+/// <summary>
+/// Deleting through the index removes cells for good: emptied leaves are merged
+/// away and their pages go on the free list, so inserting the rows again reuses
+/// them instead of growing the index file, and every row comes back exactly once.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, BtreeDeleteTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 1 v int 1");
+	ASSERT_EQ(db.CreateTable("shrink", columns), Result::OK);
+	Table* t = db.GetTable("shrink");
+	Pager* idPages = ((Btree<int32_t>*)t->colIdx["id"])->pager;
+
+	auto insertAll = [&]() {
+		for (uint32_t i = 0; i < 20000; i++) {
+			std::stringstream row;
+			row << (i * 7919) % 20000 << " " << i % 100;
+			db.Insert("shrink", row);
+		}
+	};
+	insertAll();
+	uint32_t fullPages = idPages->numPages;
+	EXPECT_GT(fullPages, 40u);
+
+	// from both indexes, in several ranges, so merges happen all over the tree
+	int32_t l = 0, r = 4999;
+	EXPECT_EQ(db.DeleteWithRange(t, "id", &l, &r), 5000u);
+	l = 10, r = 89;
+	EXPECT_EQ(db.DeleteWithRange(t, "v", &l, &r), 12000u);
+	l = 5000, r = 19999;
+	EXPECT_EQ(db.DeleteWithRange(t, "id", &l, &r), 3000u);
+
+	RowSet rows(t);
+	l = 0, r = 99;
+	db.SelectWithRange(t, "v", &l, &r, rows);
+	EXPECT_TRUE(rows.empty());
+
+	insertAll();
+	EXPECT_EQ(idPages->numPages, fullPages);
+
+	l = 0, r = 19999;
+	db.SelectWithRange(t, "id", &l, &r, rows);
+	EXPECT_EQ(rows.size(), 20000u);
+
+	l = 42, r = 42;
+	db.SelectWithRange(t, "v", &l, &r, rows);
+	EXPECT_EQ(rows.size(), 200u);
+
+	db.DropTable("shrink");
+}
+
+/// <summary>
+/// Ids counting up fill every leaf: a full last leaf is not split in half, the
+/// next id starts a new leaf. Inserts in the middle afterwards split as usual.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, SequentialInsertTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 1");
+	ASSERT_EQ(db.CreateTable("seq", columns), Result::OK);
+	Table* t = db.GetTable("seq");
+	Btree<int32_t>* index = (Btree<int32_t>*)t->colIdx["id"];
+
+	const uint32_t leaves = 50;
+	const int32_t n = leaves * Btree<int32_t>::LEAF_NODE_MAX_CELLS;
+	for (int32_t i = 0; i < n; i++) {
+		std::stringstream row;
+		row << i * 2;
+		db.Insert("seq", row);
+	}
+	EXPECT_EQ(index->pager->numPages, leaves + 1); // the leaves and the root
+	EXPECT_EQ(index->Check(), "");
+
+	for (int32_t i = 0; i < n; i += 7) {
+		std::stringstream row;
+		row << i * 2 + 1;
+		db.Insert("seq", row);
+	}
+	EXPECT_EQ(index->Check(), "");
+
+	int32_t l = 0, r = 2 * n;
+	EXPECT_EQ(t->CountRange("id", &l, &r), (uint32_t)(n + (n + 6) / 7));
+
+	db.DropTable("seq");
+}
+
+/// <summary>
+/// Batches go into every index of the table at once: the first one builds the trees
+/// from empty, the second lands between the keys already there and splits full leaves.
+/// Both leave the trees valid and every row findable through either index.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, InsertBatchTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 1 name char 16");
+	ASSERT_EQ(db.CreateTable("batch", columns), Result::OK);
+	Table* t = db.GetTable("batch");
+	ASSERT_EQ(db.CreateIndex("batch", "name"), Result::OK);
+
+	auto insertBatch = [&](uint32_t first, uint32_t n) {
+		RowSet rows(t);
+		for (uint32_t i = first; i < first + n; i++) {
+			std::stringstream values;
+			values << (i * 7919) % 40000 << " \"n" << std::setw(6) << std::setfill('0') << i / 3 << "\"";
+			Row row = rows.Append();
+			t->ParseRow(values, row);
+		}
+		t->InsertBatch(rows);
+	};
+	insertBatch(0, 20000);
+	insertBatch(20000, 20000);
+
+	Btree<int32_t>* ids = (Btree<int32_t>*)t->colIdx["id"];
+	EXPECT_EQ(ids->Check(), "");
+	EXPECT_EQ(((Btree<FixedKey<16>>*)t->colIdx["name"])->Check(), "");
+	EXPECT_EQ(t->LiveRows(), 40000u);
+
+	int32_t l = 0, r = 39999;
+	std::vector<uint32_t> rowIds;
+	t->SelectRange("id", &l, &r, rowIds);
+	ASSERT_EQ(rowIds.size(), 40000u);
+	for (uint32_t i = 0; i < rowIds.size(); i++) {
+		EXPECT_EQ(*(int32_t*)((char*)t->RowSlot(rowIds[i], 0) + t->colPtr["id"]->offset), (int32_t)i);
+	}
+
+	char lo[16] = "n000100", hi[16] = "n000199";
+	EXPECT_EQ(t->CountRange("name", lo, hi), 300u);
+
+	db.DropTable("batch");
+}
+
+/// <summary>
+/// With a write buffer, inserts and deletes wait in memory and reach the tree a few
+/// hundred at a time. Deleted rowIds are reused, so a cell can be deleted and put back
+/// while both writes are pending. Reads merge the buffer in and always see every write,
+/// including a cursor that stays open across flushes.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, BufferedIndexTest)
+{
+	auto& db = Database::GetInstance();
+	BtreeIndex::writeBufferCells = 300;
+	std::stringstream columns("id int 1 v int 0");
+	ASSERT_EQ(db.CreateTable("buffered", columns), Result::OK);
+	BtreeIndex::writeBufferCells = 0;
+	Table* t = db.GetTable("buffered");
+	Btree<int32_t>* index = (Btree<int32_t>*)t->colIdx["id"];
+
+	std::map<uint32_t, int32_t> model; // rowId -> id
+	auto expectRange = [&](int32_t l, int32_t r) {
+		std::vector<std::pair<int32_t, uint32_t>> expected;
+		for (auto& [rowId, id] : model) if (l <= id && id <= r) expected.push_back({ id, rowId });
+		std::sort(expected.begin(), expected.end());
+
+		std::vector<uint32_t> rowIds;
+		t->SelectRange("id", &l, &r, rowIds);
+		ASSERT_EQ(rowIds.size(), expected.size());
+		for (size_t i = 0; i < rowIds.size(); i++) EXPECT_EQ(rowIds[i], expected[i].second);
+		EXPECT_EQ(t->CountRange("id", &l, &r), expected.size());
+	};
+
+	uint32_t seed = 7;
+	auto next = [&]() { return seed = seed * 1103515245 + 12345, (seed >> 8) % 5000; };
+	for (uint32_t i = 0; i < 20000; i++) {
+		uint32_t dice = next() % 10;
+		if (dice < 6 || model.empty()) {
+			std::stringstream row;
+			int32_t id = next() % 2000;
+			row << id << " " << i;
+			uint32_t rowId = t->freeList.empty() ? t->rowCount : t->freeList.back();
+			db.Insert("buffered", row);
+			model[rowId] = id;
+		}
+		else {
+			auto it = model.lower_bound(next() % t->rowCount);
+			if (it == model.end()) it = model.begin();
+			t->DeleteRow(it->first);
+			model.erase(it);
+		}
+		if (i % 997 == 0) expectRange(next() % 2000, 2000);
+	}
+	EXPECT_FALSE(index->pendingInserts.empty() && index->pendingDeletes.empty());
+	expectRange(0, 1999);
+
+	// rows inserted between batches land behind the open cursor and ahead of it,
+	// up to the end of the range
+	uint32_t ahead = 0;
+	int32_t l = 0, r = 1999;
+	RowCursor* cursor = db.OpenSelect(t, "id", &l, &r);
+	uint32_t rowIds[50];
+	uint32_t seen = 0;
+	int32_t last = -1;
+	while (uint32_t n = cursor->NextBatch(rowIds, 50)) {
+		for (uint32_t i = 0; i < n; i++) {
+			int32_t id = *(int32_t*)((char*)t->RowSlot(rowIds[i], 0) + t->colPtr["id"]->offset);
+			EXPECT_GE(id, last);
+			last = id;
+		}
+		seen += n;
+		ahead += last + 1000 <= 1999 ? 10 : 0;
+		for (int32_t k = 0; k < 20; k++) {
+			std::stringstream row;
+			row << (k % 2 ? last + 1000 : last - 1) << " " << -1;
+			db.Insert("buffered", row);
+		}
+	}
+	delete cursor;
+	EXPECT_EQ(seen, model.size() + ahead);
+
+	// a buffered delete still tells whether the cell was there, pending or in the tree
+	int32_t k = 5;
+	uint32_t fake = 999999;
+	EXPECT_FALSE(index->Delete(&k, fake));
+	index->Insert(&k, fake);
+	EXPECT_TRUE(index->Delete(&k, fake));
+	EXPECT_FALSE(index->Delete(&k, fake));
+	index->Insert(&k, fake);
+	index->Flush();
+	EXPECT_TRUE(index->Delete(&k, fake));
+	EXPECT_FALSE(index->Delete(&k, fake));
+	k = -100; // below every id, so rowId 0 is the first cell of its key
+	index->Insert(&k, 0);
+	index->Flush();
+	EXPECT_TRUE(index->Delete(&k, 0));
+	EXPECT_FALSE(index->Delete(&k, 0));
+
+	index->Flush();
+	EXPECT_TRUE(index->pendingInserts.empty() && index->pendingDeletes.empty());
+	EXPECT_EQ(index->Check(), "");
+	l = -1, r = 2999;
+	EXPECT_EQ(t->CountRange("id", &l, &r), t->LiveRows());
+
+	db.DropTable("buffered");
+}
+
+/// <summary>
+/// A range is streamed: through the index rows come in key order, a few at a time,
+/// and rows inserted behind the cursor between batches split the leaves it stands on
+/// without a row being skipped or handed out twice. Scans yield rows in rowId order.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, RangeCursorTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 1 v int 0");
+	ASSERT_EQ(db.CreateTable("stream", columns), Result::OK);
+	Table* t = db.GetTable("stream");
+
+	// ids 0..4999 in scattered order, v = rowId
+	for (uint32_t i = 0; i < 5000; i++) {
+		std::stringstream row;
+		row << (i * 7919) % 5000 << " " << i;
+		db.Insert("stream", row);
+	}
+
+	int32_t l = 1000, r = 2999;
+	RowCursor* cursor = db.OpenSelect(t, "id", &l, &r);
+	ASSERT_NE(cursor, nullptr);
+	Row row;
+	int32_t expected = l;
+	while (cursor->Next(row)) {
+		EXPECT_EQ(*(int32_t*)row.Value("id"), expected);
+		expected++;
+	}
+	EXPECT_EQ(expected, r + 1);
+	delete cursor;
+
+	l = 0, r = 4999;
+	cursor = db.OpenSelect(t, "id", &l, &r);
+	uint32_t rowIds[5];
+	uint32_t seen = 0, batch = 0;
+	int32_t last = -1;
+	while (uint32_t n = cursor->NextBatch(rowIds, 5)) {
+		EXPECT_LE(n, 5u);
+		for (uint32_t i = 0; i < n; i++) {
+			int32_t id = *(int32_t*)((char*)t->RowSlot(rowIds[i], 0) + t->colPtr["id"]->offset);
+			EXPECT_EQ(id, last + 1);
+			last = id;
+		}
+		seen += n;
+
+		// keys behind the cursor, in the leaf it stopped at
+		if (last > 0 && batch++ % 2 == 0) {
+			for (uint32_t i = 0; i < 4; i++) {
+				std::stringstream row;
+				row << last - 1 << " " << -1;
+				db.Insert("stream", row);
+			}
+		}
+	}
+	EXPECT_EQ(seen, 5000u);
+	delete cursor;
+	EXPECT_EQ(((Btree<int32_t>*)t->colIdx["id"])->Check(), "");
+
+	l = 0, r = 99;
+	cursor = db.OpenSelect(t, "v", &l, &r);
+	uint32_t next = 0;
+	while (uint32_t n = cursor->NextBatch(rowIds, 5)) {
+		for (uint32_t i = 0; i < n; i++) EXPECT_EQ(rowIds[i], next++);
+	}
+	EXPECT_EQ(next, 100u);
+	delete cursor;
+
+	EXPECT_EQ(db.OpenSelect(t, "missing", &l, &r), nullptr);
+
+	db.DropTable("stream");
+}
+
+/// <summary>
+/// Range lookups and counts through an index are answered from its leaves:
+/// the heap file is not read at all, deleted rows are still left out, and
+/// rowId 0 at the low end of a range is not skipped.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, IndexOnlyRangeTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 1");
+	ASSERT_EQ(db.CreateTable("count", columns), Result::OK);
+	Table* t = db.GetTable("count");
+
+	// ids 0..999, each twice
+	for (uint32_t i = 0; i < 2000; i++) {
+		std::stringstream row;
+		row << i % 1000;
+		db.Insert("count", row);
+	}
+	int32_t l = 100, r = 199;
+	EXPECT_EQ(db.DeleteWithRange(t, "id", &l, &r), 200u);
+	EXPECT_EQ(db.CountAll(t), 1800u);
+
+	uint64_t heapReads = t->pager->stats.hits + t->pager->stats.misses;
+
+	l = 0, r = 0;
+	EXPECT_EQ(db.CountWithRange(t, "id", &l, &r), 2u);
+	l = 50, r = 249;
+	EXPECT_EQ(db.CountWithRange(t, "id", &l, &r), 200u);
+	l = 0, r = 999;
+	EXPECT_EQ(db.CountWithRange(t, "id", &l, &r), 1800u);
+	l = 5, r = 4;
+	EXPECT_EQ(db.CountWithRange(t, "id", &l, &r), 0u);
+
+	std::vector<uint32_t> rowIds;
+	l = 0, r = 9;
+	t->SelectRange("id", &l, &r, rowIds);
+	std::sort(rowIds.begin(), rowIds.end());
+	ASSERT_EQ(rowIds.size(), 20u);
+	EXPECT_EQ(rowIds[0], 0u);
+
+	EXPECT_EQ(t->pager->stats.hits + t->pager->stats.misses, heapReads);
+
+	db.DropTable("count");
+}
+
+/// <summary>
+/// char columns can be indexed too: keys are compared as zero-padded bytes, so
+/// an index answers the same ranges a heap scan does, also for a column wide
+/// enough to leave only a handful of keys per node, and after deletes.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, StringIndexTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 0 name char 20 sku char 200 tag char 8");
+	ASSERT_EQ(db.CreateTable("strs", columns), Result::OK);
+	Table* t = db.GetTable("strs");
+
+	for (uint32_t i = 0; i < 5000; i++) {
+		char name[16], sku[16];
+		snprintf(name, sizeof(name), "user%05u", (i * 7919) % 5000);
+		snprintf(sku, sizeof(sku), "sku-%u", i);
+		std::stringstream row;
+		row << i << " " << std::quoted(name) << " " << std::quoted(sku) << " \"tag" << i % 10 << "\"";
+		db.Insert("strs", row);
+	}
+	ASSERT_EQ(db.CreateIndex("strs", "name"), Result::OK);
+	ASSERT_EQ(db.CreateIndex("strs", "sku"), Result::OK);
+
+	// bounds are passed in the column's layout, zero-padded to its size
+	auto key = [](const std::string& s, size_t size) {
+		std::vector<char> k(size, 0);
+		memcpy(k.data(), s.data(), s.size());
+		return k;
+	};
+
+	auto l = key("user01000", 20), r = key("user01999", 20);
+	EXPECT_EQ(db.CountWithRange(t, "name", l.data(), r.data()), 1000u);
+	l = key("user01", 20), r = key("user01", 20);
+	EXPECT_EQ(db.CountWithRange(t, "name", l.data(), r.data()), 0u);
+
+	// "sku-1" < "sku-10" < ... < "sku-1999" < "sku-2"
+	l = key("sku-1", 200), r = key("sku-2", 200);
+	EXPECT_EQ(db.CountWithRange(t, "sku", l.data(), r.data()), 1112u);
+	EXPECT_EQ(db.DeleteWithRange(t, "sku", l.data(), r.data()), 1112u);
+	EXPECT_EQ(db.CountWithRange(t, "sku", l.data(), r.data()), 0u);
+
+	// every row left is still in the name index exactly once
+	l = key("user", 20), r = key("user99999", 20);
+	EXPECT_EQ(db.CountWithRange(t, "name", l.data(), r.data()), 5000u - 1112u);
+
+	// unindexed char columns are scanned with the same comparison
+	l = key("tag3", 8), r = key("tag3", 8);
+	RowSet rows(t);
+	db.SelectWithRange(t, "tag", l.data(), r.data(), rows);
+	EXPECT_EQ(rows.size(), 500u - 111u);
+
+	db.DropTable("strs");
+}
+
+/// <summary>
+/// The vectorized int32 key search must agree with a plain binary search for
+/// every node size (including ones that end in a partial SIMD block), with
+/// duplicate keys and with keys below, between and above the stored ones.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, KeySearchTest)
+{
+	std::vector<int32_t> keys;
+	for (uint32_t n = 0; n <= 600; n += (n < 80 ? 1 : 37)) {
+		keys.resize(n);
+		for (uint32_t i = 0; i < n; i++) keys[i] = (int32_t)(i / 3) * 2 - 100;
+
+		for (int32_t key = -110; key <= (int32_t)n; key++) {
+			uint32_t less = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+			uint32_t lessOrEqual = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+			ASSERT_EQ(KeyRank(keys.data(), n, key, false), less) << "n=" << n << " key=" << key;
+			ASSERT_EQ(KeyRank(keys.data(), n, key, true), lessOrEqual) << "n=" << n << " key=" << key;
+			ASSERT_EQ(KeyRankNear(keys.data(), n, key, false), less) << "n=" << n << " key=" << key;
+			ASSERT_EQ(KeyRankNear(keys.data(), n, key, true), lessOrEqual) << "n=" << n << " key=" << key;
+		}
+	}
+}
+
+/// <summary>
+/// A scan filters a whole heap page into a bitmask. The vectorized int filter must
+/// set exactly the bits a row-by-row check would, for odd slot sizes, for pages that
+/// end in a partial SIMD block and for deleted slots; through a table, rows deleted
+/// at the first and last slot of a page must not come back from a range scan.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, PageScanTest)
+{
+	std::vector<char> page(PAGE_SIZE);
+	uint64_t mask[PAGE_SIZE / 64];
+	for (uint32_t rowSize : { 5u, 7u, 12u, 33u }) {
+		uint32_t offset = rowSize - 4;
+		uint32_t rows = PAGE_SIZE / rowSize;
+		for (uint32_t i = 0; i < rows; i++) {
+			int32_t v = (int32_t)(i * 7919 % 200) - 100;
+			page[i * rowSize] = i % 5 == 0;
+			memcpy(page.data() + i * rowSize + offset, &v, sizeof(v));
+		}
+
+		for (uint32_t n : { 0u, 1u, 7u, 8u, 9u, 64u, 65u, rows }) {
+			for (int32_t l = -101; l <= 101; l += 17) {
+				int32_t r = l + 40;
+				FilterSlots<int32_t>(page.data(), n, rowSize, offset, 4, l, r, mask);
+				for (uint32_t i = 0; i < n; i++) {
+					int32_t v;
+					memcpy(&v, page.data() + i * rowSize + offset, sizeof(v));
+					bool keep = i % 5 != 0 && l <= v && v <= r;
+					ASSERT_EQ((mask[i / 64] >> (i % 64)) & 1, (uint64_t)keep) << "rowSize=" << rowSize << " n=" << n << " i=" << i;
+				}
+			}
+		}
+	}
+
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 0 v int 0 pad char 3");
+	ASSERT_EQ(db.CreateTable("scan", columns), Result::OK);
+	Table* t = db.GetTable("scan");
+
+	const uint32_t N = 5000;
+	std::vector<int32_t> values(N);
+	std::vector<bool> live(N, true);
+	for (uint32_t i = 0; i < N; i++) {
+		values[i] = (int32_t)(i * 7919 % 1000) - 500;
+		std::stringstream row;
+		row << i << " " << values[i] << " \"p\"";
+		db.Insert("scan", row);
+	}
+
+	// the first and last slot of every third page, and the very last row
+	for (uint32_t first = 0; first < N; first += 3 * t->rowsPerPage) {
+		for (int32_t id : { (int32_t)first, (int32_t)std::min(first + t->rowsPerPage, N) - 1 }) {
+			EXPECT_EQ(db.DeleteWithRange(t, "id", &id, &id), 1u);
+			live[id] = false;
+		}
+	}
+	int32_t last = N - 1;
+	EXPECT_EQ(db.DeleteWithRange(t, "id", &last, &last), live[last] ? 1u : 0u);
+	live[last] = false;
+
+	for (int32_t l = -520; l <= 520; l += 130) {
+		int32_t r = l + 250;
+		std::vector<uint32_t> expected, rowIds;
+		for (uint32_t i = 0; i < N; i++) if (live[i] && l <= values[i] && values[i] <= r) expected.push_back(i);
+		t->SelectRange("v", &l, &r, rowIds);
+		EXPECT_EQ(rowIds, expected) << "l=" << l;
+		EXPECT_EQ(t->CountRange("v", &l, &r), (uint32_t)expected.size());
+	}
+
+	uint32_t alive = std::count(live.begin(), live.end(), true);
+	EXPECT_EQ(db.DeleteAll(t), alive);
+	EXPECT_EQ(db.CountAll(t), 0u);
+
+	db.DropTable("scan");
+}
+
+/// <summary>
+/// A table of several morsels is scanned by the worker pool. Rows must come out in
+/// rowId order exactly as a serial scan yields them, counts must add up, deletes
+/// must see every match, and two scans read in turns (or one abandoned halfway)
+/// must neither block each other nor leave workers behind.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, ParallelScanTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 0 v int 0");
+	ASSERT_EQ(db.CreateTable("morsels", columns), Result::OK);
+	Table* t = db.GetTable("morsels");
+
+	const uint32_t N = 300000;
+	std::vector<int32_t> values(N);
+	RowSet rows(t);
+	for (uint32_t i = 0; i < N; i++) {
+		values[i] = (int32_t)(i * 7919 % 10000);
+		Row r = rows.Append();
+		memcpy(r.Value("id"), &i, sizeof(i));
+		memcpy(r.Value("v"), &values[i], sizeof(int32_t));
+	}
+	t->InsertBatch(rows);
+	ASSERT_GT(MorselScan::Workers(t), 1u);
+
+	std::vector<bool> live(N, true);
+	int32_t l = 2000, r = 2999;
+	uint32_t matches = 0;
+	for (uint32_t i = 0; i < N; i++) matches += l <= values[i] && values[i] <= r;
+	EXPECT_EQ(db.DeleteWithRange(t, "v", &l, &r), matches);
+	for (uint32_t i = 0; i < N; i++) if (l <= values[i] && values[i] <= r) live[i] = false;
+
+	l = 1500, r = 4499;
+	std::vector<uint32_t> expected, rowIds;
+	for (uint32_t i = 0; i < N; i++) if (live[i] && l <= values[i] && values[i] <= r) expected.push_back(i);
+	t->SelectRange("v", &l, &r, rowIds);
+	EXPECT_EQ(rowIds, expected);
+	EXPECT_EQ(t->CountRange("v", &l, &r), (uint32_t)expected.size());
+
+	// the views point into pinned pages while the workers run ahead
+	RowCursor* all = t->OpenScan();
+	RowCursor* range = t->OpenRange("v", &l, &r);
+	Row row;
+	uint32_t seen = 0;
+	bool ordered = true;
+	for (uint32_t i = 0; i < N; i++) {
+		if (!live[i]) continue;
+		ASSERT_TRUE(all->Next(row));
+		ordered = ordered && *(uint32_t*)row.Value("id") == i;
+		if (i % 3 == 0 && range->Next(row)) ordered = ordered && *(uint32_t*)row.Value("id") == expected[seen++];
+	}
+	EXPECT_TRUE(ordered);
+	EXPECT_FALSE(all->Next(row));
+	delete all;
+	delete range;
+
+	RowCursor* abandoned = t->OpenScan();
+	uint32_t batch[RowCursor::BATCH_ROWS];
+	EXPECT_EQ(abandoned->NextBatch(batch, RowCursor::BATCH_ROWS), RowCursor::BATCH_ROWS);
+	delete abandoned;
+
+	uint32_t alive = std::count(live.begin(), live.end(), true);
+	EXPECT_EQ(db.DeleteAll(t), alive);
+	EXPECT_EQ(db.CountAll(t), 0u);
+
+	db.DropTable("morsels");
+}
+
+/// <summary>
+/// A column that grows with the rowIds has narrow zones: a range scan on it reads
+/// only the pages that can hold the range, serially or in morsels. Zones must still
+/// cover rows written into reused slots, and come back the same from the zone file
+/// or, when that is missing or stale, from a pass over the heap.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, ZoneMapTest)
+{
+	auto& db = Database::GetInstance();
+	for (uint32_t N : { 20000u, 300000u }) {
+		std::stringstream columns("ts int 0 v int 0");
+		ASSERT_EQ(db.CreateTable("zones", columns), Result::OK);
+		Table* t = db.GetTable("zones");
+		std::string zoneFile = "my_db_zones.zone";
+		remove(zoneFile.c_str());
+
+		RowSet rows(t);
+		for (uint32_t i = 0; i < N; i++) {
+			int32_t ts = 1000 + i, v = i % 7;
+			Row r = rows.Append();
+			memcpy(r.Value("ts"), &ts, sizeof(ts));
+			memcpy(r.Value("v"), &v, sizeof(v));
+		}
+		t->InsertBatch(rows);
+
+		// the row in rowId 100 goes, and its slot is reused for a late timestamp
+		int32_t l = 1100, r = 1100;
+		EXPECT_EQ(db.DeleteWithRange(t, "ts", &l, &r), 1u);
+		std::stringstream late;
+		late << 5000000 << " " << 3;
+		db.Insert("zones", late);
+
+		auto check = [&]() {
+			int32_t l = 1000 + N / 2, r = l + 999;
+			uint64_t reads = t->pager->stats.hits + t->pager->stats.misses;
+			std::vector<uint32_t> rowIds;
+			t->SelectRange("ts", &l, &r, rowIds);
+			ASSERT_EQ(rowIds.size(), 1000u);
+			EXPECT_EQ(rowIds.front(), N / 2);
+			EXPECT_EQ(rowIds.back(), N / 2 + 999);
+			// the pages of the range, and page 0 that the late timestamp widened
+			EXPECT_LE(t->pager->stats.hits + t->pager->stats.misses - reads, 1000u / t->rowsPerPage + 3);
+
+			l = 4000000, r = 6000000;
+			rowIds.clear();
+			t->SelectRange("ts", &l, &r, rowIds);
+			EXPECT_EQ(rowIds, std::vector<uint32_t>{ 100u });
+			EXPECT_EQ(t->CountRange("ts", &l, &r), 1u);
+			l = -5, r = 999;
+			EXPECT_EQ(t->CountRange("ts", &l, &r), 0u);
+			l = 3, r = 3;
+			EXPECT_EQ(t->CountRange("v", &l, &r), (N + 3) / 7 + 1);
+		};
+		check();
+
+		t->SaveZones();
+		t->zones.Clear();
+		t->LoadZones();
+		check();
+
+		remove(zoneFile.c_str());
+		t->zones.Clear();
+		t->LoadZones();
+		check();
+
+		// saved at another rowCount: rebuilt, not trusted
+		t->SaveZones();
+		std::stringstream more;
+		more << 7000000 << " " << 0;
+		db.Insert("zones", more);
+		t->zones.Clear();
+		t->LoadZones();
+		l = 7000000, r = 7000000;
+		EXPECT_EQ(t->CountRange("ts", &l, &r), 1u);
+
+		db.DropTable("zones");
+		remove(zoneFile.c_str());
+	}
+}
+
+/// <summary>
+/// An unindexed delete flags rows while the workers of its own scan keep loading
+/// pages into the small pool. Every matching row must end up flagged: a flag
+/// written into a frame that was reused meanwhile would leave the row live while
+/// its rowId is already free for the next insert.
+/// </summary>
+/// <param name=""></param>
+/// <param name=""></param>
+TEST(DatabaseTests, ParallelDeleteTest)
+{
+	auto& db = Database::GetInstance();
+	std::stringstream columns("id int 0 v int 0");
+	ASSERT_EQ(db.CreateTable("pdelete", columns), Result::OK);
+	Table* t = db.GetTable("pdelete");
+
+	const uint32_t N = 300000;
+	RowSet rows(t);
+	for (uint32_t i = 0; i < N; i++) {
+		int32_t v = i % 1000;
+		Row r = rows.Append();
+		memcpy(r.Value("id"), &i, sizeof(i));
+		memcpy(r.Value("v"), &v, sizeof(v));
+	}
+	t->InsertBatch(rows);
+	ASSERT_GT(MorselScan::Workers(t), 1u);
+
+	for (int32_t round = 0; round < 4; round++) {
+		int32_t l = round * 250, r = l + 249;
+		EXPECT_EQ(db.DeleteWithRange(t, "v", &l, &r), N / 4);
+		EXPECT_EQ(t->freeList.size(), (size_t)(round + 1) * N / 4);
+
+		uint32_t bad = 0;
+		for (uint32_t rowId : t->freeList) bad += !t->IsRowDeleted(rowId);
+		l = 0, r = (round + 1) * 250 - 1;
+		bad += t->CountRange("v", &l, &r);
+		EXPECT_EQ(bad, 0u) << "round " << round;
+	}
+	EXPECT_EQ(db.CountAll(t), 0u);
+
+	db.DropTable("pdelete");
+}